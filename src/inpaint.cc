@@ -1,356 +1,3296 @@
+// Tile stores outgrow 2 GB; 32-bit builds need the 64-bit off_t for their offsets. Set
+// before any header, so that the whole program agrees on it.
+#ifndef _WIN32
+#define _FILE_OFFSET_BITS 64
+#endif
+
 #include <vector>
 #include <cmath>
 #include <iostream>
 #include <algorithm>
 #include <string>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <queue>
+#include <cstring>
+#include <memory>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <type_traits>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h>
 #include <SDL3_image/SDL_image.h>
 #include "hsluv.h"
 
-// Brush settings
-int BRUSH_RADIUS = 15;
-bool useFill = false;
+// RGB and YCbCr planes are float32 unless built with -DINPAINT_DOUBLE: half the memory traffic,
+// and twice the lanes per SIMD instruction. Float rounding limits the biharmonic fill of very large
+// holes to a fraction of a grey level; double planes (HSLuv, or that build) have no vector kernels.
+#ifdef INPAINT_DOUBLE
+typedef double Sample;
+#else
+typedef float Sample;
+#endif
+
+// Brush settings
+int BRUSH_RADIUS = 15;
+bool useFill = false;
+bool useMarch = false;    // fast-marching fill instead of a solver
+
+// Solver settings
+double SOR_OMEGA = 1.8;    // over-relaxation of the Laplace and Biharmonic sweeps, 1 = Gauss-Seidel
+double SOLVE_TOLERANCE = 1e-5;    // solving stops once the relative residual |b - Au| / |b| is below this
+long long SOLVE_MAX_SWEEPS = 20000;    // headless solves give up here, multigrid after 1/100 as many cycles
+
+// Fixed set of worker threads. parallelFor hands out task indices until they run out;
+// the calling thread works too and returns once every task is done.
+class ThreadPool {
+public:
+    explicit ThreadPool(int threads) {
+        for (int i = 1; i < threads; ++i) workers.emplace_back([this] { run(); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : workers) t.join();
+    }
+
+    int size() const { return (int)workers.size() + 1; }
+
+    void parallelFor(int tasks, const std::function<void(int)>& fn) {
+        if (workers.empty() || tasks <= 1) {
+            for (int i = 0; i < tasks; ++i) fn(i);
+            return;
+        }
+        std::lock_guard<std::mutex> caller(callMutex);    // one job at a time
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &fn;
+            jobTasks = tasks;
+            next = 0;
+            pending = (int)workers.size();
+            ++generation;
+        }
+        wake.notify_all();
+        work();
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return pending == 0; });
+        job = nullptr;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex, callMutex;
+    std::condition_variable wake, done;
+    const std::function<void(int)>* job = nullptr;
+    int jobTasks = 0;
+    std::atomic<int> next{0};
+    int pending = 0;
+    unsigned generation = 0;
+    bool quit = false;
+
+    void work() {
+        for (int i = next++; i < jobTasks; i = next++) (*job)(i);
+    }
+
+    void run() {
+        unsigned seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return quit || generation != seen; });
+                if (quit) return;
+                seen = generation;
+            }
+            work();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0) done.notify_one();
+        }
+    }
+};
+
+ThreadPool& sweepPool() {
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+    return pool;
+}
+
+// Set on threads that already run one of several independent solves (batch mode), whose
+// sweeps would only queue up on the shared pool
+thread_local bool serialSweeps = false;
+
+// Run of masked pixels [x0, x1) within one row
+struct MaskSpan {
+    int x0, x1;
+};
+
+// One sorted, non-overlapping list of runs per row. Solvers walk these instead of the whole
+// frame, so a sweep costs as much as the hole, not the image.
+typedef std::vector<std::vector<MaskSpan>> SpanRows;
+
+// Adds [x0, x1) to a row, merging it with every run it overlaps or touches
+void addSpan(std::vector<MaskSpan>& row, int x0, int x1) {
+    auto first = std::lower_bound(row.begin(), row.end(), x0,
+                                  [](const MaskSpan& s, int x) { return s.x1 < x; });
+    auto last = first;
+    while (last != row.end() && last->x0 <= x1) {
+        x0 = std::min(x0, last->x0);
+        x1 = std::max(x1, last->x1);
+        ++last;
+    }
+    row.insert(row.erase(first, last), {x0, x1});
+}
+
+void buildRowSpans(const uint8_t* mask, int w, std::vector<MaskSpan>& row) {
+    row.clear();
+    for (int x = 0; x < w;) {
+        if (!mask[x]) {
+            ++x;
+            continue;
+        }
+        int x0 = x;
+        while (x < w && mask[x]) ++x;
+        row.push_back({x0, x});
+    }
+}
+
+void buildSpans(const std::vector<uint8_t>& mask, int w, int h, SpanRows& rows) {
+    rows.assign(h, {});
+    for (int y = 0; y < h; ++y) buildRowSpans(&mask[y * w], w, rows[y]);
+}
+
+// Planes of T, the Scalar of the colour space that fills them (see ColourImage)
+template <class T>
+class Image {
+public:
+    int w, h;
+    std::vector<T> r, g, b;
+    std::vector<uint8_t> mask;   // 1 = masked (missing), 0 = fixed
+    SpanRows spans;              // masked runs, kept in sync with mask
+    SDL_Rect dirty;              // pixels changed since the last toTexture
+
+    Image() : w(0), h(0), dirty{0, 0, 0, 0} {}
+
+    virtual void init(int width, int height) {
+        w = width;
+        h = height;
+        r.assign(w * h, 0);
+        g.assign(w * h, 0);
+        b.assign(w * h, 0);
+        mask.assign(w * h, 0);
+        spans.assign(h, {});
+        dirty = {0, 0, w, h};
+    }
+
+    // Masks [x0, x1) of row y
+    void maskRun(int y, int x0, int x1) {
+        std::fill(mask.begin() + y * w + x0, mask.begin() + y * w + x1, 1);
+        addSpan(spans[y], x0, x1);
+        markDirty(x0, y, x1, y + 1);
+    }
+
+    // Grows the dirty rectangle to cover [x0, x1) x [y0, y1)
+    void markDirty(int x0, int y0, int x1, int y1) {
+        x0 = std::max(x0, 0);
+        y0 = std::max(y0, 0);
+        x1 = std::min(x1, w);
+        y1 = std::min(y1, h);
+        if (x0 >= x1 || y0 >= y1) return;
+        if (dirty.w > 0 && dirty.h > 0) {
+            x0 = std::min(x0, dirty.x);
+            y0 = std::min(y0, dirty.y);
+            x1 = std::max(x1, dirty.x + dirty.w);
+            y1 = std::max(y1, dirty.y + dirty.h);
+        }
+        dirty = {x0, y0, x1 - x0, y1 - y0};
+    }
+
+    // Marks the bounding box of the mask, which is all a solver writes
+    void markMaskDirty() {
+        for (int y = 0; y < h; ++y)
+            if (!spans[y].empty()) markDirty(spans[y].front().x0, y, spans[y].back().x1, y + 1);
+    }
+
+    // Resyncs spans after mask was written directly
+    void updateSpans() {
+        buildSpans(mask, w, h, spans);
+    }
+
+    // Same for [x0, x1) x [y0, y1) only; runs reaching into it are rebuilt whole
+    void updateSpans(int x0, int y0, int x1, int y1) {
+        std::vector<MaskSpan> middle;
+        for (int y = y0; y < y1; ++y) {
+            std::vector<MaskSpan>& row = spans[y];
+            auto first = std::lower_bound(row.begin(), row.end(), x0,
+                                          [](const MaskSpan& s, int x) { return s.x1 < x; });
+            auto last = first;
+            while (last != row.end() && last->x0 <= x1) ++last;
+            int a = first != last ? std::min(x0, first->x0) : x0;
+            int b = first != last ? std::max(x1, (last - 1)->x1) : x1;
+            buildRowSpans(&mask[y * w + a], b - a, middle);
+            for (MaskSpan& s : middle) s = {s.x0 + a, s.x1 + a};
+            row.insert(row.erase(first, last), middle.begin(), middle.end());
+        }
+    }
+
+    virtual void fromSurface(SDL_Surface* surf)=0;
+    virtual void toSurface(SDL_Surface* surf) {
+        SDL_Rect all = {0, 0, w, h};
+        this->toPixels(surf->pixels, surf->pitch, all);
+    }
+    // Uploads only the dirty rectangle
+    virtual void toTexture(SDL_Texture* tex) {
+        if (dirty.w <= 0 || dirty.h <= 0) return;
+        void* pixels = nullptr;
+        int pitch;
+        if (SDL_LockTexture(tex, &dirty, &pixels, &pitch)) {
+            this->toPixels(pixels, pitch, dirty);
+            SDL_UnlockTexture(tex);
+        }
+        dirty = {0, 0, 0, 0};
+    }
+    // Converts the pixels of rect; pixels points at the rect's top-left corner
+    virtual void toPixels(void* pixels, int pitch, const SDL_Rect& rect)=0;
+};
+
+// Fast HSLuv to 8-bit RGB for display. hsluv2rgb spends its time in twelve sin/cos calls (two
+// per gamut bound it intersects the hue ray with) and three pow calls for the sRGB curve.
+// Here the hue's sine and cosine are interpolated from a 0.1 degree table, the six bounds are computed
+// once per pixel, and the sRGB curve is a table over linear intensity. Gives the same bytes as
+// hsluv2rgb for every colour of the 8-bit cube, and is off by at most one level for the values
+// in between that the solvers produce (--check-hsluv); saving still uses the exact conversion.
+class HSLuvDisplayTable {
+public:
+    HSLuvDisplayTable() : hue(2 * (HUE_STEPS + 1)), gamma(GAMMA_STEPS + 1) {
+        for (int i = 0; i <= HUE_STEPS; ++i) {
+            double a = i * 2.0 * std::acos(-1.0) / HUE_STEPS;
+            hue[2 * i] = std::sin(a);
+            hue[2 * i + 1] = std::cos(a);
+        }
+        for (int i = 0; i <= GAMMA_STEPS; ++i) {
+            double c = (double)i / GAMMA_STEPS;
+            double s = c <= 0.0031308 ? 12.92 * c : 1.055 * std::pow(c, 1.0 / 2.4) - 0.055;
+            gamma[i] = (uint8_t)std::lround(s * 255.0);
+        }
+    }
+
+    // 0xAARRGGBB, as the image classes write it
+    uint32_t pixel(double h, double s, double l) const {
+        if (l < 1e-8) return 0xFF000000u;
+        if (l > 99.9999999) return 0xFFFFFFFFu;
+        double fh = h * (HUE_STEPS / 360.0);
+        double step = std::floor(fh);
+        int hi = (int)step % HUE_STEPS;
+        if (hi < 0) hi += HUE_STEPS;
+        double ah = fh - step;
+        const double* h0 = &hue[2 * hi];
+        double sinH = h0[0] + ah * (h0[2] - h0[0]), cosH = h0[1] + ah * (h0[3] - h0[1]);
+
+        // Largest chroma along the hue ray inside the sRGB gamut at this lightness (get_bounds
+        // and max_chroma_for_lh in hsluv.c)
+        double tl = l + 16.0;
+        double sub1 = tl * tl * tl / 1560896.0;
+        double sub2 = sub1 > 0.00885645167903563082 ? sub1 : l / 903.2962962962963;
+        double maxChroma = 1e300;
+        for (int c = 0; c < 3; ++c) {
+            const double* m = M[c];
+            for (int t = 0; t < 2; ++t) {
+                double top1 = (284517.0 * m[0] - 94839.0 * m[2]) * sub2;
+                double top2 = (838422.0 * m[2] + 769860.0 * m[1] + 731718.0 * m[0]) * l * sub2 - 769860.0 * t * l;
+                double bottom = (632260.0 * m[2] - 126452.0 * m[1]) * sub2 + 126452.0 * t;
+                double len = top2 / (bottom * sinH - top1 * cosH);
+                if (len >= 0.0 && len < maxChroma) maxChroma = len;
+            }
+        }
+        double chroma = s < 1e-8 ? 0.0 : maxChroma / 100.0 * s;
+
+        // LCh -> Luv -> XYZ -> linear RGB
+        double var_u = chroma * cosH / (13.0 * l) + REF_U;
+        double var_v = chroma * sinH / (13.0 * l) + REF_V;
+        double y = l <= 8.0 ? l / 903.2962962962963 : sub1;
+        double x = 9.0 * y * var_u / (4.0 * var_v);
+        double z = (9.0 * y - 15.0 * var_v * y - var_v * x) / (3.0 * var_v);
+        uint32_t rgb[3];
+        for (int c = 0; c < 3; ++c) rgb[c] = encode(M[c][0] * x + M[c][1] * y + M[c][2] * z);
+        return 0xFF000000u | (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+    }
+
+private:
+    static const int HUE_STEPS = 3600, GAMMA_STEPS = 16384;
+    static constexpr double REF_U = 0.19783000664283680764, REF_V = 0.46831999493879100370;
+    static constexpr double M[3][3] = {
+        {3.24096994190452134377, -1.53738317757009345794, -0.49861076029300328366},
+        {-0.96924363628087982613, 1.87596750150772066772, 0.04155505740717561247},
+        {0.05563007969699360846, -0.20397695888897656435, 1.05697151424287856072}};
+    std::vector<double> hue;       // sin, cos per step, one past 360 degrees to interpolate
+    std::vector<uint8_t> gamma;    // linear -> sRGB byte
+
+    uint32_t encode(double linear) const {
+        return gamma[(int)(std::clamp(linear, 0.0, 1.0) * GAMMA_STEPS + 0.5)];
+    }
+};
+
+const HSLuvDisplayTable& hsluvDisplayTable() {
+    static HSLuvDisplayTable table;
+    return table;
+}
+
+// Colour spaces the three planes can hold. Each policy converts one pixel: forward() from
+// 0xAARRGGBB to the planes, display() back for the screen and exact() back for saving. Scalar
+// is what the planes store and the solvers work on. The policies are inlined into ColourImage's
+// loops, so every space gets conversion loops of its own that the compiler can vectorize;
+// expensive spaces are cached and banded.
+
+// Plain RGB, the planes are the 8-bit channels
+struct RgbSpace {
+    typedef Sample Scalar;
+    static const bool expensive = false;
+
+    static void forward(uint32_t p, Scalar* out) {
+        out[0] = (Scalar)((p >> 16) & 0xFF);
+        out[1] = (Scalar)((p >> 8) & 0xFF);
+        out[2] = (Scalar)(p & 0xFF);
+    }
+    static uint32_t display(Scalar r, Scalar g, Scalar b) {
+        return 0xFF000000u | (byte(r) << 16) | (byte(g) << 8) | byte(b);
+    }
+    static uint32_t exact(Scalar r, Scalar g, Scalar b) { return display(r, g, b); }
+
+    // Rounded, so that a round trip through any space gives back the original bytes
+    template <class T>
+    static uint32_t byte(T v) { return (uint32_t)(int)std::min(std::max(v + (T)0.5, (T)0), (T)255); }
+};
+
+// Luma and two colour differences; the solvers smear chroma less visibly than in RGB
+struct YcbcrSpace {
+    typedef Sample Scalar;
+    static const bool expensive = false;
+
+    static void forward(uint32_t p, Scalar* out) {
+        Scalar r = (Scalar)((p >> 16) & 0xFF), g = (Scalar)((p >> 8) & 0xFF), b = (Scalar)(p & 0xFF);
+        Scalar y = (Scalar)0.299 * r + (Scalar)0.587 * g + (Scalar)0.114 * b;
+        out[0] = y;
+        out[1] = (Scalar)0.564 * (b - y);
+        out[2] = (Scalar)0.713 * (r - y);
+    }
+    static uint32_t display(Scalar y, Scalar cb, Scalar cr) {
+        Scalar r = cr / (Scalar)0.713 + y;
+        Scalar b = cb / (Scalar)0.564 + y;
+        Scalar g = (y - (Scalar)0.299 * r - (Scalar)0.114 * b) / (Scalar)0.587;
+        return RgbSpace::display(r, g, b);
+    }
+    static uint32_t exact(Scalar y, Scalar cb, Scalar cr) { return display(y, cb, cr); }
+};
+
+// HSLuv hue, saturation and lightness. The conversions need double precision, so the planes
+// are double too; the exact ones are slow, so the screen takes HSLuvDisplayTable instead.
+struct HSLuvSpace {
+    typedef double Scalar;
+    static const bool expensive = true;
+
+    static void forward(uint32_t p, Scalar* out) {
+        rgb2hsluv(((p >> 16) & 0xFF) / 255.0, ((p >> 8) & 0xFF) / 255.0, (p & 0xFF) / 255.0, &out[0], &out[1], &out[2]);
+    }
+    static uint32_t display(Scalar h, Scalar s, Scalar l) { return hsluvDisplayTable().pixel(h, s, l); }
+    static uint32_t exact(Scalar h, Scalar s, Scalar l) {
+        double r, g, b;
+        hsluv2rgb(h, s, l, &r, &g, &b);
+        return 0xFF000000u | (RgbSpace::byte(r * 255) << 16) | (RgbSpace::byte(g * 255) << 8) | RgbSpace::byte(b * 255);
+    }
+};
+
+template <class Space>
+class ColourImage final : public Image<typename Space::Scalar> {
+public:
+    typedef typename Space::Scalar Scalar;
+    using Image<Scalar>::w;
+    using Image<Scalar>::h;
+    using Image<Scalar>::r;
+    using Image<Scalar>::g;
+    using Image<Scalar>::b;
+
+    virtual void fromSurface(SDL_Surface* surf) {
+        this->init(surf->w, surf->h);
+        const uint32_t* pixels = (const uint32_t*)surf->pixels;
+        Scalar* planes[3] = {r.data(), g.data(), b.data()};
+        if constexpr (Space::expensive) {
+            // Photos repeat colours a lot, so the conversions go through a direct-mapped
+            // cache on the 24-bit colour
+            struct Entry { uint32_t rgb; Scalar c[3]; };
+            std::vector<Entry> cache(1 << 16, {0xFFFFFFFFu, {0, 0, 0}});
+            for (int i = 0; i < w * h; ++i) {
+                uint32_t rgb = pixels[i] & 0xFFFFFF;
+                Entry& e = cache[(rgb * 2654435761u) >> 16];
+                if (e.rgb != rgb) {
+                    e.rgb = rgb;
+                    Space::forward(rgb, e.c);
+                }
+                for (int c = 0; c < 3; ++c) planes[c][i] = e.c[c];
+            }
+        } else {
+            for (int i = 0; i < w * h; ++i) {
+                Scalar c[3];
+                Space::forward(pixels[i], c);
+                planes[0][i] = c[0];
+                planes[1][i] = c[1];
+                planes[2][i] = c[2];
+            }
+        }
+    }
+
+    virtual void toSurface(SDL_Surface* surf) {
+        SDL_Rect all = {0, 0, w, h};
+        convert(surf->pixels, surf->pitch, all, [](Scalar a, Scalar b, Scalar c) { return Space::exact(a, b, c); });
+    }
+
+    virtual void toPixels(void* pixels, int pitch, const SDL_Rect& rect) {
+        convert(pixels, pitch, rect, [](Scalar a, Scalar b, Scalar c) { return Space::display(a, b, c); });
+    }
+
+private:
+    // Expensive spaces take a band of rows per worker
+    template <class Pixel>
+    void convert(void* pixels, int pitch, const SDL_Rect& rect, Pixel pixel) const {
+        auto rows = [&](int y0, int y1) {
+            for (int y = y0; y < y1; ++y) {
+                uint32_t* row = (uint32_t*)((uint8_t*)pixels + y * pitch);
+                int idx = (rect.y + y) * w + rect.x;
+                const Scalar* p0 = &r[idx];
+                const Scalar* p1 = &g[idx];
+                const Scalar* p2 = &b[idx];
+                for (int x = 0; x < rect.w; ++x) row[x] = pixel(p0[x], p1[x], p2[x]);
+            }
+        };
+        int bands = Space::expensive && !serialSweeps ? std::min(sweepPool().size(), rect.h) : 1;
+        if (bands <= 1) rows(0, rect.h);
+        else sweepPool().parallelFor(bands, [&](int band) { rows(band * rect.h / bands, (band + 1) * rect.h / bands); });
+    }
+};
+
+typedef ColourImage<RgbSpace> FloatImage;
+typedef ColourImage<YcbcrSpace> YcbcrImage;
+typedef ColourImage<HSLuvSpace> HSLuvImage;
+
+// Helper: Load image from disk as 8-bit RGBA, or nullptr
+SDL_Surface* loadSurface(const std::string& path) {
+    SDL_Surface* loadedSurface = IMG_Load(path.c_str());
+    if (!loadedSurface) {
+        std::cerr << "IMG_Load failed: " << SDL_GetError() << std::endl;
+        return nullptr;
+    }
+
+    SDL_Surface* formattedSurf = SDL_ConvertSurface(loadedSurface, SDL_PIXELFORMAT_RGBA32);
+    SDL_DestroySurface(loadedSurface);
+    return formattedSurf;
+}
+
+// Helper: Load image from disk and convert to FloatImage
+template <class T>
+bool loadImage(const std::string& path, Image<T>& img) {
+    SDL_Surface* formattedSurf = loadSurface(path);
+    if (!formattedSurf) return false;
+
+    img.fromSurface(formattedSurf);
+
+    SDL_DestroySurface(formattedSurf);
+    return true;
+}
+
+template <class T>
+void saveImage(Image<T>& img, const std::string& path) {
+    SDL_Surface* surf = SDL_CreateSurface(img.w, img.h, SDL_PIXELFORMAT_RGBA32);
+    img.toSurface(surf);
+    IMG_SavePNG(surf, path.c_str());
+    SDL_DestroySurface(surf);
+}
+
+// Returns the largest change to any masked pixel
+template <class T>
+double fillMask(Image<T>& img) {
+    int w = img.w;
+    int h = img.h;
+    double change = 0.0;
+
+    // Nearest known row below every masked pixel, stored in span order. A bottom-up pass keeps
+    // the last known row of each column; the blend pass below does the same top-down.
+    std::vector<int> rowStart(h + 1, 0);
+    for (int y = 0; y < h; ++y) {
+        rowStart[y + 1] = rowStart[y];
+        for (const MaskSpan& s : img.spans[y]) rowStart[y + 1] += s.x1 - s.x0;
+    }
+    std::vector<int> below(rowStart[h]);
+    std::vector<int> known(w, h - 1);
+    auto markKnown = [&](int y) {
+        int x = 0;
+        for (const MaskSpan& s : img.spans[y]) {
+            for (; x < s.x0; ++x) known[x] = y;
+            x = s.x1;
+        }
+        for (; x < w; ++x) known[x] = y;
+    };
+    for (int y = h - 1; y >= 0; --y) {
+        int i = rowStart[y];
+        for (const MaskSpan& s : img.spans[y])
+            for (int x = s.x0; x < s.x1; ++x) below[i++] = known[x];
+        markKnown(y);
+    }
+
+    known.assign(w, 0);
+    for (int y = 0; y < h; ++y) {
+        int i = rowStart[y];
+        for (const MaskSpan& s : img.spans[y]) {
+            // The walk along the row ends at the pixels either side of the run, or the border
+            int x_left = std::max(s.x0 - 1, 0);
+            int x_right = std::min(s.x1, w - 1);
+            for (int x = s.x0; x < s.x1; ++x, ++i) {
+                if (y == 0 || y == h - 1 || x == 0 || x == w - 1) continue;
+                int idx = y * w + x;
+                int y_up = known[x];
+                int y_down = below[i];
+                int n_up    = (y_up) * w + x;
+                int n_down  = (y_down) * w + x;
+                int n_left  = y * w + (x_left);
+                int n_right = y * w + (x_right);
+
+                double d_up = y - y_up, d_down = y_down - y, d_left = x - x_left, d_right = x_right - x;
+                double r_up = 1. / (d_up * d_up);
+                double r_down = 1. / (d_down * d_down);
+                double r_left = 1. / (d_left * d_left);
+                double r_right = 1. / (d_right * d_right);
+                double r_sum = r_up + r_down + r_left + r_right;
+
+                double k_up = r_up / r_sum;
+                double k_down = r_down / r_sum;
+                double k_left = r_left / r_sum;
+                double k_right = r_right / r_sum;
+
+                T r = img.r[n_up] * k_up + img.r[n_down] * k_down + img.r[n_left] * k_left + img.r[n_right] * k_right;
+                T g = img.g[n_up] * k_up + img.g[n_down] * k_down + img.g[n_left] * k_left + img.g[n_right] * k_right;
+                T b = img.b[n_up] * k_up + img.b[n_down] * k_down + img.b[n_left] * k_left + img.b[n_right] * k_right;
+                change = std::max({change, (double)std::abs(r - img.r[idx]), (double)std::abs(g - img.g[idx]),
+                                   (double)std::abs(b - img.b[idx])});
+                img.r[idx] = r;
+                img.g[idx] = g;
+                img.b[idx] = b;
+            }
+        }
+        markKnown(y);
+    }
+    img.markMaskDirty();
+    return change;
+}
+
+// Telea's fast-marching inpainting: the hole is filled from its edge inwards in order of the
+// front's arrival time T, found with a narrow band kept in a heap. Each pixel is the average of
+// the filled pixels within radius, weighted by direction along grad T, distance and closeness
+// of their T. The paper's first-order term (extrapolating along each neighbour's image
+// gradient) is only applied from pixels outside the hole: fed by inpainted pixels it
+// amplifies across large holes. One pass, O(N log N), and the result depends only on the
+// known pixels. Returns the largest change to any masked pixel.
+template <class S>
+double fastMarch(Image<S>& img, int radius = 5) {
+    int x0 = img.w, y0 = img.h, x1 = 0, y1 = 0;
+    for (int y = 0; y < img.h; ++y) {
+        if (img.spans[y].empty()) continue;
+        x0 = std::min(x0, img.spans[y].front().x0);
+        x1 = std::max(x1, img.spans[y].back().x1);
+        y0 = std::min(y0, y);
+        y1 = y + 1;
+    }
+    if (x0 >= x1) return 0.0;
+    // Work on the hole's bounding box plus the reach of the estimate
+    x0 = std::max(x0 - radius - 1, 0);
+    y0 = std::max(y0 - radius - 1, 0);
+    x1 = std::min(x1 + radius + 1, img.w);
+    y1 = std::min(y1 + radius + 1, img.h);
+    int w = x1 - x0, h = y1 - y0;
+
+    enum { KNOWN, BAND, INSIDE };
+    const float FAR = 1e6f;
+    std::vector<uint8_t> flag(w * h);
+    std::vector<float> T(w * h);
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x) {
+            bool masked = img.mask[(y + y0) * img.w + x + x0];
+            flag[y * w + x] = masked ? INSIDE : KNOWN;
+            T[y * w + x] = masked ? FAR : 0.0f;
+        }
+
+    typedef std::pair<float, int> Front;
+    std::priority_queue<Front, std::vector<Front>, std::greater<Front>> band;
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x) {
+            int i = y * w + x;
+            if (flag[i] != KNOWN) continue;
+            if ((x > 0 && flag[i - 1] == INSIDE) || (x < w - 1 && flag[i + 1] == INSIDE) ||
+                (y > 0 && flag[i - w] == INSIDE) || (y < h - 1 && flag[i + w] == INSIDE))
+                band.push({0.0f, i});
+        }
+
+    // Upwind solution of |grad T| = 1 from the known neighbours in each quadrant
+    auto known = [&](int x, int y) { return x >= 0 && y >= 0 && x < w && y < h && flag[y * w + x] == KNOWN; };
+    auto arrival = [&](int x, int y) {
+        float best = FAR;
+        for (int dx = -1; dx <= 1; dx += 2)
+            for (int dy = -1; dy <= 1; dy += 2) {
+                bool hx = known(x + dx, y), hy = known(x, y + dy);
+                if (!hx && !hy) continue;
+                float tx = hx ? T[y * w + x + dx] : FAR, ty = hy ? T[(y + dy) * w + x] : FAR;
+                float d = tx - ty;
+                float t = hx && hy && d * d < 2.0f ? (tx + ty + std::sqrt(2.0f - d * d)) * 0.5f
+                                                   : std::min(tx, ty) + 1.0f;
+                best = std::min(best, t);
+            }
+        return best;
+    };
+    // grad T by central differences where both sides are filled, one-sided where only one is
+    auto difference = [&](int x, int y, int dx, int dy) -> double {
+        bool back = x - dx >= 0 && y - dy >= 0 && flag[(y - dy) * w + x - dx] != INSIDE;
+        bool ahead = x + dx < w && y + dy < h && flag[(y + dy) * w + x + dx] != INSIDE;
+        int i = y * w + x, step = dy * w + dx;
+        if (back && ahead) return (T[i + step] - T[i - step]) * 0.5;
+        if (ahead) return T[i + step] - T[i];
+        if (back) return T[i] - T[i - step];
+        return 0.0;
+    };
+
+    // Image gradient at a pixel outside the hole, from neighbours outside the hole
+    auto imageGradient = [&](const S* v, int x, int y, int dx, int dy) -> double {
+        int i = (y + y0) * img.w + x + x0, step = dy * img.w + dx;
+        bool back = x - dx >= 0 && y - dy >= 0 && !img.mask[i - step];
+        bool ahead = x + dx < w && y + dy < h && !img.mask[i + step];
+        if (back && ahead) return (v[i + step] - v[i - step]) * 0.5;
+        if (ahead) return v[i + step] - v[i];
+        if (back) return v[i] - v[i - step];
+        return 0.0;
+    };
+
+    S* planes[3] = {img.r.data(), img.g.data(), img.b.data()};
+    double change = 0.0;
+    auto inpaint = [&](int x, int y) {
+        int i = y * w + x;
+        double gx = difference(x, y, 1, 0);
+        double gy = difference(x, y, 0, 1);
+        double sum[3] = {0.0, 0.0, 0.0}, weights = 0.0;
+        for (int ky = std::max(y - radius, 0); ky <= std::min(y + radius, h - 1); ++ky)
+            for (int kx = std::max(x - radius, 0); kx <= std::min(x + radius, w - 1); ++kx) {
+                int k = ky * w + kx;
+                int rx = x - kx, ry = y - ky;
+                int d2 = rx * rx + ry * ry;
+                if (flag[k] == INSIDE || d2 == 0 || d2 > radius * radius) continue;
+                double len = std::sqrt((double)d2);
+                double dir = std::abs(rx * gx + ry * gy) / len;
+                if (dir < 0.01) dir = 1e-6;
+                double weight = dir / (d2 * len) / (1.0 + std::abs(T[k] - T[i]));
+                int idx = (ky + y0) * img.w + kx + x0;
+                for (int c = 0; c < 3; ++c) {
+                    double extrapolated = planes[c][idx];
+                    if (!img.mask[idx])
+                        extrapolated += rx * imageGradient(planes[c], kx, ky, 1, 0) + ry * imageGradient(planes[c], kx, ky, 0, 1);
+                    sum[c] += weight * extrapolated;
+                }
+                weights += weight;
+            }
+        if (weights <= 0.0) return;
+        int idx = (y + y0) * img.w + x + x0;
+        for (int c = 0; c < 3; ++c) {
+            S value = (S)(sum[c] / weights);
+            change = std::max(change, (double)std::abs(value - planes[c][idx]));
+            planes[c][idx] = value;
+        }
+    };
+
+    while (!band.empty()) {
+        Front front = band.top();
+        band.pop();
+        int i = front.second;
+        if (front.first > T[i]) continue;    // superseded by a later, smaller arrival time
+        flag[i] = KNOWN;
+        int x = i % w, y = i / w;
+        const int nx[4] = {x - 1, x + 1, x, x}, ny[4] = {y, y, y - 1, y + 1};
+        for (int n = 0; n < 4; ++n) {
+            if (nx[n] < 0 || ny[n] < 0 || nx[n] >= w || ny[n] >= h) continue;
+            int j = ny[n] * w + nx[n];
+            if (flag[j] == KNOWN) continue;
+            float t = arrival(nx[n], ny[n]);
+            if (flag[j] == INSIDE) {
+                T[j] = t;
+                inpaint(nx[n], ny[n]);
+                flag[j] = BAND;
+                band.push({t, j});
+            } else if (t < T[j]) {
+                T[j] = t;
+                band.push({t, j});
+            }
+        }
+    }
+    img.markDirty(x0, y0, x1, y1);
+    return change;
+}
+
+// Draw the mask at mouse position
+template <class T>
+void applyBrush(Image<T>& img, int mx, int my, bool clear=false, int radius=BRUSH_RADIUS) {
+    int r2 = radius * radius;
+
+    for (int y = std::max(my - radius, 0); y <= std::min(my + radius, img.h - 1); ++y) {
+        // Each row of the disc is a single run
+        int dy = y - my;
+        int dx = (int)std::sqrt((double)(r2 - dy * dy));
+        int x0 = std::max(mx - dx, 0);
+        int x1 = std::min(mx + dx + 1, img.w);
+        if (x0 >= x1) continue;
+
+        img.maskRun(y, x0, x1);
+        if (clear) {
+            for (int x = x0; x < x1; ++x) {
+                int idx = y * img.w + x;
+                img.r[idx] = 0;
+                img.g[idx] = 0;
+                img.b[idx] = 0;
+            }
+        }
+    }
+    if (clear && useFill) fillMask(img);
+    else if (clear && useMarch) fastMarch(img);
+}
+
+template <class T, class U>
+void loadMask(Image<T>& img, const Image<U>& mask) {
+    for (int i = 0; i < img.h * img.w; ++i) {
+        if (mask.r[i] == 0 && mask.g[i] == 0 && mask.b[i] == 0) {
+            img.mask[i] = 1;
+        }
+    }
+    img.updateSpans();
+    fillMask(img);
+}
+
+// Everything a relaxation sweep works on: three planes, an optional right-hand side and the
+// unknown runs. Solves A u = f in the unscaled stencil form used by all solvers below.
+template <class T>
+struct SweepGrid {
+    int w, h;
+    const SpanRows* spans;
+    const uint8_t* mask;      // same cells as spans, one byte each
+    T* u[3];
+    T* f[3];                  // nullptr = 0
+    bool biharmonic;
+    double omega;             // SOR factor
+    bool clamp;               // keep results in [0, 255]
+};
+
+// Sweeps are coloured so that pixels of one colour can be updated in any order across rows,
+// and bands of rows go to different threads.
+// Laplace uses red-black: (x + y) & 1. No pixel reads another of its own colour.
+// The 13-point stencil uses (x & 1) + 2 * (y & 3): every other pixel of every fourth row.
+// Only the far left/right neighbours (x +- 2) share a colour, and those are in the same row,
+// which a single thread walks left to right. The vector kernels update a run of them from
+// the old values. That splitting converges while the over-relaxed diagonal, 2/omega - 1 of
+// it, outweighs the two x +- 2 couplings, 2/20 of it: omega < 20/11 = 1.818...
+int sweepColours(bool biharmonic) { return biharmonic ? 8 : 2; }
+
+// The omega a sweep runs with. Biharmonic sweeps are capped at 1.8, which keeps a margin
+// below 20/11 (the default SOR_OMEGA sits right at the cap); Laplace takes omega as given.
+double sweepOmega(double omega, bool biharmonic) {
+    return biharmonic ? std::min(omega, 1.8) : omega;
+}
+
+bool rowHasColour(int y, int colour, bool biharmonic) {
+    return !biharmonic || (y & 3) == colour >> 1;
+}
+
+// Pixels of the colour in row y are those with (x & 1) == colourParity
+int colourParity(int y, int colour, bool biharmonic) {
+    return biharmonic ? colour & 1 : (colour + y) & 1;
+}
+
+// Scalar relaxation of the pixels of one colour in [x0, x1) of row y.
+// Returns the largest change made to any channel.
+template <class T>
+double relaxScalar(const SweepGrid<T>& g, int y, int colour, int x0, int x1) {
+    double change = 0.0;
+    int w = g.w;
+    int parity = colourParity(y, colour, g.biharmonic);
+    for (const MaskSpan& s : (*g.spans)[y]) {
+        int start = std::max(s.x0, x0);
+        int end = std::min(s.x1, x1);
+        for (int x = start + ((parity - start) & 1); x < end; x += 2) {
+            int idx = y * w + x;
+            for (int c = 0; c < 3; ++c) {
+                T* v = g.u[c];
+                double rhs = g.f[c] ? g.f[c][idx] : 0.0;
+                double sum_n = v[idx - w] + v[idx + w] + v[idx - 1] + v[idx + 1];
+                double gs;
+                if (g.biharmonic) {
+                    double sum_d = v[idx - w - 1] + v[idx - w + 1] + v[idx + w - 1] + v[idx + w + 1];
+                    double sum_f = v[idx - 2 * w] + v[idx + 2 * w] + v[idx - 2] + v[idx + 2];
+                    gs = (rhs + 8.0 * sum_n - 2.0 * sum_d - sum_f) / 20.0;
+                } else {
+                    gs = (rhs + sum_n) * 0.25;
+                }
+                double value = v[idx] + g.omega * (gs - v[idx]);
+                T result = (T)(g.clamp ? std::clamp(value, 0.0, 255.0) : value);
+                change = std::max(change, (double)std::abs(result - v[idx]));
+                v[idx] = result;
+            }
+        }
+    }
+    return change;
+}
+
+// SIMD kernels: the stencil is evaluated for a run of contiguous pixels at once, and the result
+// is stored only where the byte mask is set and the lane has the colour being relaxed. Other
+// lanes are never written: threads relaxing neighbouring bands read them as stencil inputs
+// during the same pass. Each returns the first x it did not handle and raises change to the
+// largest change it made. They exist for float planes only.
+typedef int (*RowKernel)(const SweepGrid<float>& g, int y, int colour, int x0, int x1, double& change);
+
+// Blend mask of the lanes with the given parity, for runs starting at x0 (runs advance by an
+// even number of pixels, so it holds for the whole row)
+void colourLanes(int x0, int parity, int width, int32_t* lanes) {
+    for (int i = 0; i < width; ++i) lanes[i] = ((x0 + i) & 1) == parity ? -1 : 0;
+}
+
+#if !defined(INPAINT_DOUBLE) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+int relaxRowAVX2(const SweepGrid<float>& g, int y, int colour, int x0, int x1, double& change) {
+    const int W = 8;
+    int w = g.w;
+    alignas(32) int32_t lanes[W];
+    colourLanes(x0, colourParity(y, colour, g.biharmonic), W, lanes);
+    const __m256i lane = _mm256_load_si256((const __m256i*)lanes);
+
+    const __m256 omega = _mm256_set1_ps((float)g.omega);
+    const __m256 lo = _mm256_setzero_ps(), hi = _mm256_set1_ps(255.0f);
+    const __m256 quarter = _mm256_set1_ps(0.25f), twentieth = _mm256_set1_ps(1.0f / 20.0f);
+    const __m256 eight = _mm256_set1_ps(8.0f), two = _mm256_set1_ps(2.0f);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 delta = _mm256_setzero_ps();
+
+    int x = x0;
+    for (; x + W <= x1; x += W) {
+        int idx = y * w + x;
+        uint64_t bytes;
+        std::memcpy(&bytes, g.mask + idx, sizeof(bytes));
+        if (!bytes) continue;
+        __m256i m8 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(g.mask + idx)));
+        __m256 blend = _mm256_castsi256_ps(_mm256_and_si256(_mm256_cmpgt_epi32(m8, _mm256_setzero_si256()), lane));
+        if (_mm256_testz_ps(blend, blend)) continue;
+
+        for (int c = 0; c < 3; ++c) {
+            float* v = g.u[c];
+            __m256 center = _mm256_loadu_ps(v + idx);
+            __m256 rhs = g.f[c] ? _mm256_loadu_ps(g.f[c] + idx) : _mm256_setzero_ps();
+            __m256 sum_n = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(v + idx - w), _mm256_loadu_ps(v + idx + w)),
+                                         _mm256_add_ps(_mm256_loadu_ps(v + idx - 1), _mm256_loadu_ps(v + idx + 1)));
+            __m256 gs;
+            if (g.biharmonic) {
+                __m256 sum_d = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_loadu_ps(v + idx - w - 1), _mm256_loadu_ps(v + idx - w + 1)),
+                    _mm256_add_ps(_mm256_loadu_ps(v + idx + w - 1), _mm256_loadu_ps(v + idx + w + 1)));
+                __m256 sum_f = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_loadu_ps(v + idx - 2 * w), _mm256_loadu_ps(v + idx + 2 * w)),
+                    _mm256_add_ps(_mm256_loadu_ps(v + idx - 2), _mm256_loadu_ps(v + idx + 2)));
+                gs = _mm256_sub_ps(_mm256_add_ps(rhs, _mm256_mul_ps(eight, sum_n)),
+                                   _mm256_add_ps(_mm256_mul_ps(two, sum_d), sum_f));
+                gs = _mm256_mul_ps(gs, twentieth);
+            } else {
+                gs = _mm256_mul_ps(_mm256_add_ps(rhs, sum_n), quarter);
+            }
+            __m256 value = _mm256_add_ps(center, _mm256_mul_ps(omega, _mm256_sub_ps(gs, center)));
+            if (g.clamp) value = _mm256_min_ps(_mm256_max_ps(value, lo), hi);
+            __m256 result = _mm256_blendv_ps(center, value, blend);
+            delta = _mm256_max_ps(delta, _mm256_andnot_ps(sign, _mm256_sub_ps(result, center)));
+            _mm256_maskstore_ps(v + idx, _mm256_castps_si256(blend), value);
+        }
+    }
+    alignas(32) float lanesDelta[W];
+    _mm256_store_ps(lanesDelta, delta);
+    for (float d : lanesDelta) change = std::max(change, (double)d);
+    return x;
+}
+
+__attribute__((target("sse4.1")))
+int relaxRowSSE41(const SweepGrid<float>& g, int y, int colour, int x0, int x1, double& change) {
+    const int W = 4;
+    int w = g.w;
+    alignas(16) int32_t lanes[W];
+    colourLanes(x0, colourParity(y, colour, g.biharmonic), W, lanes);
+    const __m128i lane = _mm_load_si128((const __m128i*)lanes);
+
+    const __m128 omega = _mm_set1_ps((float)g.omega);
+    const __m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(255.0f);
+    const __m128 quarter = _mm_set1_ps(0.25f), twentieth = _mm_set1_ps(1.0f / 20.0f);
+    const __m128 eight = _mm_set1_ps(8.0f), two = _mm_set1_ps(2.0f);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 delta = _mm_setzero_ps();
+
+    int x = x0;
+    for (; x + W <= x1; x += W) {
+        int idx = y * w + x;
+        uint32_t bytes;
+        std::memcpy(&bytes, g.mask + idx, sizeof(bytes));
+        if (!bytes) continue;
+        __m128i m8 = _mm_cvtepu8_epi32(_mm_cvtsi32_si128((int)bytes));
+        __m128 blend = _mm_castsi128_ps(_mm_and_si128(_mm_cmpgt_epi32(m8, _mm_setzero_si128()), lane));
+        int selected = _mm_movemask_ps(blend);
+        if (selected == 0) continue;
+
+        for (int c = 0; c < 3; ++c) {
+            float* v = g.u[c];
+            __m128 center = _mm_loadu_ps(v + idx);
+            __m128 rhs = g.f[c] ? _mm_loadu_ps(g.f[c] + idx) : _mm_setzero_ps();
+            __m128 sum_n = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(v + idx - w), _mm_loadu_ps(v + idx + w)),
+                                      _mm_add_ps(_mm_loadu_ps(v + idx - 1), _mm_loadu_ps(v + idx + 1)));
+            __m128 gs;
+            if (g.biharmonic) {
+                __m128 sum_d = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(v + idx - w - 1), _mm_loadu_ps(v + idx - w + 1)),
+                                          _mm_add_ps(_mm_loadu_ps(v + idx + w - 1), _mm_loadu_ps(v + idx + w + 1)));
+                __m128 sum_f = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(v + idx - 2 * w), _mm_loadu_ps(v + idx + 2 * w)),
+                                          _mm_add_ps(_mm_loadu_ps(v + idx - 2), _mm_loadu_ps(v + idx + 2)));
+                gs = _mm_sub_ps(_mm_add_ps(rhs, _mm_mul_ps(eight, sum_n)), _mm_add_ps(_mm_mul_ps(two, sum_d), sum_f));
+                gs = _mm_mul_ps(gs, twentieth);
+            } else {
+                gs = _mm_mul_ps(_mm_add_ps(rhs, sum_n), quarter);
+            }
+            __m128 value = _mm_add_ps(center, _mm_mul_ps(omega, _mm_sub_ps(gs, center)));
+            if (g.clamp) value = _mm_min_ps(_mm_max_ps(value, lo), hi);
+            __m128 result = _mm_blendv_ps(center, value, blend);
+            delta = _mm_max_ps(delta, _mm_andnot_ps(sign, _mm_sub_ps(result, center)));
+            // maskmovps needs AVX; store the selected lanes one by one
+            alignas(16) float values[W];
+            _mm_store_ps(values, value);
+            for (int i = 0; i < W; ++i)
+                if (selected >> i & 1) v[idx + i] = values[i];
+        }
+    }
+    alignas(16) float lanesDelta[W];
+    _mm_store_ps(lanesDelta, delta);
+    for (float d : lanesDelta) change = std::max(change, (double)d);
+    return x;
+}
+
+RowKernel detectRowKernel() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return relaxRowAVX2;
+    if (__builtin_cpu_supports("sse4.1")) return relaxRowSSE41;
+    return nullptr;
+}
+#else
+RowKernel detectRowKernel() {
+    return nullptr;
+}
+#endif
+
+bool useSIMD = true;    // --no-simd forces the scalar path
+
+RowKernel rowKernel() {
+    static RowKernel kernel = detectRowKernel();
+    return useSIMD ? kernel : nullptr;
+}
+
+// Runs kernel over [x0, x1) of row y where the planes are float; double planes are left to
+// relaxScalar. Returns the first x not handled.
+template <class T>
+int relaxVector(RowKernel kernel, const SweepGrid<T>& g, int y, int colour, int x0, int x1, double& change) {
+    if constexpr (std::is_same<T, float>::value) {
+        if (kernel) return kernel(g, y, colour, x0, x1, change);
+    }
+    return x0;
+}
+
+template <class T>
+double relaxRows(const SweepGrid<T>& g, int colour, int y0, int y1) {
+    int m = g.biharmonic ? 2 : 1;
+    RowKernel kernel = rowKernel();
+    double change = 0.0;
+    for (int y = y0; y < y1; ++y) {
+        const std::vector<MaskSpan>& row = (*g.spans)[y];
+        if (row.empty() || !rowHasColour(y, colour, g.biharmonic)) continue;
+        // Vector kernels cover the row from its first to its last run, skipping the gaps by mask
+        int x0 = std::max(row.front().x0, m);
+        int x1 = std::min(row.back().x1, g.w - m);
+        if (x0 < x1) x0 = relaxVector(kernel, g, y, colour, x0, x1, change);
+        change = std::max(change, relaxScalar(g, y, colour, x0, x1));
+    }
+    return change;
+}
+
+// Like relaxRows, but the vector kernels stay inside each run, so masked pixels between runs
+// that the grid does not list are never touched
+template <class T>
+double relaxRuns(const SweepGrid<T>& g, int colour, int y0, int y1) {
+    int m = g.biharmonic ? 2 : 1;
+    RowKernel kernel = rowKernel();
+    double change = 0.0;
+    for (int y = y0; y < y1; ++y) {
+        if (!rowHasColour(y, colour, g.biharmonic)) continue;
+        for (const MaskSpan& s : (*g.spans)[y]) {
+            int x0 = std::max(s.x0, m);
+            int x1 = std::min(s.x1, g.w - m);
+            if (x0 < x1) x0 = relaxVector(kernel, g, y, colour, x0, x1, change);
+            if (x0 < x1) change = std::max(change, relaxScalar(g, y, colour, x0, x1));
+        }
+    }
+    return change;
+}
+
+// Splits rows [y0, y1) into bands holding about the same number of unknowns
+std::vector<int> splitRows(const SpanRows& spans, int y0, int y1, int bands) {
+    long total = 0;
+    for (int y = y0; y < y1; ++y)
+        for (const MaskSpan& s : spans[y]) total += s.x1 - s.x0;
+
+    std::vector<int> bounds = {y0};
+    long acc = 0;
+    for (int y = y0; y < y1; ++y) {
+        for (const MaskSpan& s : spans[y]) acc += s.x1 - s.x0;
+        if ((int)bounds.size() < bands && acc * bands >= total * (long)bounds.size()) bounds.push_back(y + 1);
+    }
+    bounds.push_back(y1);
+    return bounds;
+}
+
+// One sweep over all colours; returns the largest change to any masked pixel. With runsOnly
+// rows are relaxed by relaxRuns, for grids that list only part of the mask.
+template <class T>
+double sweepColoured(const SweepGrid<T>& g, bool runsOnly = false) {
+    auto relax = [&](int colour, int y0, int y1) {
+        return runsOnly ? relaxRuns(g, colour, y0, y1) : relaxRows(g, colour, y0, y1);
+    };
+    int m = g.biharmonic ? 2 : 1;
+    // A band per thread is enough for a few thousand unknowns; below that threads only cost time
+    int bands = 4 * sweepPool().size();
+    std::vector<int> bounds = splitRows(*g.spans, m, g.h - m, bands);
+    long unknowns = 0;
+    for (int y = m; y < g.h - m; ++y)
+        for (const MaskSpan& s : (*g.spans)[y]) unknowns += s.x1 - s.x0;
+
+    double change = 0.0;
+    std::vector<double> bandChange(bounds.size() - 1, 0.0);
+    for (int colour = 0; colour < sweepColours(g.biharmonic); ++colour) {
+        if (unknowns < 4096 || serialSweeps) {
+            change = std::max(change, relax(colour, m, g.h - m));
+            continue;
+        }
+        // The vector kernels load the rows around the one they relax whole, lanes of the colour
+        // being relaxed included, so bands that touch never run at the same time: even bands
+        // go first, then odd ones. A band is at least a row tall, which the Laplace stencil does
+        // not reach across; the rows two away that the 13-point stencil reads have other colours.
+        int count = (int)bounds.size() - 1;
+        for (int phase = 0; phase < 2; ++phase)
+            sweepPool().parallelFor((count + 1 - phase) / 2, [&](int k) {
+                int band = 2 * k + phase;
+                bandChange[band] = std::max(bandChange[band], relax(colour, bounds[band], bounds[band + 1]));
+            });
+    }
+    for (double c : bandChange) change = std::max(change, c);
+    return change;
+}
+
+// Adds the squared norms of the residual f - A u over the pixels the sweeps relax in rows
+// [y0, y1) to rr, and those of the right-hand side b that f and the known neighbours make of
+// the system over the unknowns alone to bb, per channel. When the grid clamps, a pixel held
+// at 0 or 255 by a residual pushing it further out counts as solved.
+template <class T>
+void residualNorms(const SweepGrid<T>& g, int y0, int y1, double* rr, double* bb) {
+    struct Tap { int dx, dy; double weight; };
+    static const Tap laplace[] = {{0, -1, -1}, {-1, 0, -1}, {0, 0, 4}, {1, 0, -1}, {0, 1, -1}};
+    static const Tap bilaplace[] = {
+        {0, -2, 1}, {-1, -1, 2}, {0, -1, -8}, {1, -1, 2}, {-2, 0, 1}, {-1, 0, -8}, {0, 0, 20},
+        {1, 0, -8}, {2, 0, 1}, {-1, 1, 2}, {0, 1, -8}, {1, 1, 2}, {0, 2, 1}};
+    const Tap* taps = g.biharmonic ? bilaplace : laplace;
+    int tapCount = g.biharmonic ? 13 : 5;
+    int w = g.w, m = g.biharmonic ? 2 : 1;
+    for (int y = std::max(y0, m); y < std::min(y1, g.h - m); ++y)
+        for (const MaskSpan& s : (*g.spans)[y])
+            for (int x = std::max(s.x0, m); x < std::min(s.x1, w - m); ++x) {
+                int idx = y * w + x;
+                bool unknown[13];
+                for (int t = 0; t < tapCount; ++t) {
+                    int ny = y + taps[t].dy, nx = x + taps[t].dx;
+                    unknown[t] = ny >= m && ny < g.h - m && nx >= m && nx < w - m && g.mask[ny * w + nx];
+                }
+                for (int c = 0; c < 3; ++c) {
+                    const T* v = g.u[c];
+                    double au = 0.0, b = g.f[c] ? g.f[c][idx] : 0.0;
+                    for (int t = 0; t < tapCount; ++t) {
+                        double term = taps[t].weight * v[idx + taps[t].dy * w + taps[t].dx];
+                        if (unknown[t]) au += term;
+                        else b -= term;
+                    }
+                    double r = b - au;
+                    if (g.clamp && ((v[idx] <= 0 && r < 0.0) || (v[idx] >= 255 && r > 0.0))) r = 0.0;
+                    rr[c] += r * r;
+                    bb[c] += b * b;
+                }
+            }
+}
+
+// Largest relative residual |b - A u| / |b| of the three channels, the measure the conjugate
+// gradient solver stops on. Unlike the change per sweep it does not shrink with the step an
+// over-relaxed sweep happens to take, so it tells how far the grid still is from the solution.
+template <class T>
+double relativeResidual(const SweepGrid<T>& g) {
+    int m = g.biharmonic ? 2 : 1;
+    std::vector<int> bounds = splitRows(*g.spans, m, g.h - m, 4 * sweepPool().size());
+    long unknowns = 0;
+    for (int y = m; y < g.h - m; ++y)
+        for (const MaskSpan& s : (*g.spans)[y]) unknowns += s.x1 - s.x0;
+
+    // |r|^2 and |b|^2 of the three channels per band
+    int bands = (int)bounds.size() - 1;
+    std::vector<double> sums(6 * bands, 0.0);
+    if (unknowns < 4096 || serialSweeps) {
+        residualNorms(g, m, g.h - m, &sums[0], &sums[3]);
+    } else {
+        sweepPool().parallelFor(bands, [&](int band) {
+            residualNorms(g, bounds[band], bounds[band + 1], &sums[6 * band], &sums[6 * band + 3]);
+        });
+    }
+    double residual = 0.0;
+    for (int c = 0; c < 3; ++c) {
+        double rr = 0.0, bb = 0.0;
+        for (int band = 0; band < bands; ++band) {
+            rr += sums[6 * band + c];
+            bb += sums[6 * band + 3 + c];
+        }
+        residual = std::max(residual, std::sqrt(rr) / std::max(std::sqrt(bb), 1e-30));
+    }
+    return residual;
+}
+
+template <class T>
+SweepGrid<T> imageGrid(Image<T>& img, bool biharmonic, double omega) {
+    return {img.w, img.h, &img.spans, img.mask.data(), {img.r.data(), img.g.data(), img.b.data()}, {nullptr, nullptr, nullptr},
+            biharmonic, sweepOmega(omega, biharmonic), biharmonic};
+}
+
+// 1. LAPLACE SOLVER (Membrane)
+// Minimizes 1st Derivative (Gradient). Creates a tight, smooth transition.
+// Stencil: 4 neighbors.
+//   I = Sum(N) / 4
+template <class T>
+double solveLaplaceStep(Image<T>& img, double omega = SOR_OMEGA) {
+    return sweepColoured(imageGrid(img, false, omega));
+}
+
+// 2. BIHARMONIC SOLVER (Thin Plate)
+// Minimizes 2nd Derivative (Curvature). Preserves slopes/gradients entering the hole.
+// Stencil: 13 points (Center, 4 Neighbors (Weight 8), 4 Diagonals (Weight -2), 4 Far Neighbors (Weight -1)).
+//   20*I = 8*Sum(N) - 2*Sum(D) - 1*Sum(F)
+// The stencil looks 2 pixels out, so the outer 2 rows and columns are never updated.
+template <class T>
+double solveBiharmonicStep(Image<T>& img, double omega = SOR_OMEGA) {
+    return sweepColoured(imageGrid(img, true, omega));
+}
+
+// Sweeps the holes of a mask as independent systems. The masked runs are labelled with
+// union-find, joining runs that are close enough for the stencil to couple them (adjacent for
+// Laplace, within two pixels for Biharmonic), and every component keeps its own convergence.
+// A component retires once its relative residual is below SOLVE_TOLERANCE after a round, so
+// converged holes stop costing sweeps while the rest carry on. Each round gives the widest
+// hole sweepsPerRound sweeps and narrower ones proportionally fewer. Components too big to
+// share a thread are swept one at a time in row bands; the rest are dealt to the pool whole.
+class HoleScheduler {
+public:
+    bool biharmonic = false;
+    int sweepsPerRound = 40;
+
+    // Components still sweeping, as of the last round
+    int active() const { return activeCount; }
+    int components() const { return (int)holes.size(); }
+    // Sweeps the busiest component made in the last round
+    int lastSweeps() const { return roundSweeps; }
+
+    // Forgets all convergence and the holes themselves, for a fresh solve or a changed image
+    void reset() {
+        settled.clear();
+        holes.clear();
+        activeCount = 0;
+        stale = true;
+    }
+
+    // The mask or the pixels in [x0, x1) x [y0, y1) changed: the holes there start over
+    template <class T>
+    void invalidate(const Image<T>& img, int x0, int y0, int x1, int y1) {
+        int m = biharmonic ? 2 : 1;
+        if ((int)settled.size() == img.w * img.h)
+            for (int y = std::max(y0 - m, 0); y < std::min(y1 + m, img.h); ++y)
+                std::fill(settled.begin() + y * img.w + std::max(x0 - m, 0),
+                          settled.begin() + y * img.w + std::min(x1 + m, img.w), 0);
+        stale = true;
+    }
+
+    // Sweeps every active component; returns the largest relative residual of any of them
+    template <class T>
+    double round(Image<T>& img, double omega = SOR_OMEGA) {
+        if (labelledBiharmonic != biharmonic) reset();    // settled under the other stencil
+        if (stale) label(img);
+        omega = sweepOmega(omega, biharmonic);
+
+        std::vector<int> big, small;
+        int widest = 1;
+        for (const Hole& hole : holes)
+            if (!hole.settled) widest = std::max(widest, hole.width);
+        for (int i = 0; i < (int)holes.size(); ++i) {
+            Hole& hole = holes[i];
+            if (hole.settled) continue;
+            hole.quota = std::max(1, (int)((long long)sweepsPerRound * hole.width / widest));
+            (hole.pixels >= 4096 ? big : small).push_back(i);
+        }
+        // Most work first, so the pool does not end up waiting on one large hole
+        std::sort(small.begin(), small.end(), [&](int a, int b) {
+            return (long long)holes[a].pixels * holes[a].quota > (long long)holes[b].pixels * holes[b].quota;
+        });
+
+        for (int i : big) sweep(img, holes[i], omega, true);
+        if (serialSweeps || small.size() < 2) {
+            for (int i : small) sweep(img, holes[i], omega, false);
+        } else {
+            sweepPool().parallelFor((int)small.size(), [&](int k) { sweep(img, holes[small[k]], omega, false); });
+        }
+
+        double residual = 0.0;
+        activeCount = 0;
+        roundSweeps = 0;
+        for (Hole& hole : holes) {
+            if (hole.settled) continue;
+            residual = std::max(residual, hole.residual);
+            roundSweeps = std::max(roundSweeps, hole.swept);
+            if (hole.residual < SOLVE_TOLERANCE) {
+                hole.settled = true;
+                for (int y = 0; y < (int)hole.spans.size(); ++y)
+                    for (const MaskSpan& s : hole.spans[y])
+                        std::fill(settled.begin() + (hole.y0 + y) * img.w + s.x0,
+                                  settled.begin() + (hole.y0 + y) * img.w + s.x1, 1);
+            } else {
+                ++activeCount;
+            }
+        }
+        img.markMaskDirty();
+        return residual;
+    }
+
+private:
+    // One component: its runs over its rows plus m empty rows either side, so that a grid
+    // based at row y0 sees the hole where a whole-image grid sees the mask
+    struct Hole {
+        int y0 = 0;
+        SpanRows spans;
+        long pixels = 0;
+        int width = 0;     // larger side of the bounding box
+        int quota = 0;
+        int swept = 0;     // sweeps made in the last round
+        double residual = 0.0;    // relative residual after the last round
+        bool settled = false;
+    };
+    std::vector<Hole> holes;
+    std::vector<uint8_t> settled;    // 1 = pixel of a retired component
+    bool stale = true, labelledBiharmonic = false;
+    int activeCount = 0, roundSweeps = 0;
+
+    static int find(std::vector<int>& parent, int i) {
+        while (parent[i] != i) i = parent[i] = parent[parent[i]];
+        return i;
+    }
+
+    template <class T>
+    void label(Image<T>& img) {
+        int w = img.w, h = img.h, m = biharmonic ? 2 : 1;
+        if ((int)settled.size() != w * h) settled.assign(w * h, 0);
+
+        // Runs numbered in row order; only rows the sweeps relax take part
+        std::vector<int> first(h + 1, 0);
+        for (int y = 0; y < h; ++y) first[y + 1] = first[y] + (y >= m && y < h - m ? (int)img.spans[y].size() : 0);
+        std::vector<int> parent(first[h]);
+        for (int i = 0; i < first[h]; ++i) parent[i] = i;
+        auto unite = [&](int a, int b) { parent[find(parent, a)] = find(parent, b); };
+
+        // Runs dy rows apart couple when they overlap after widening by m - dy
+        for (int y = m; y < h - m; ++y)
+            for (int dy = 0; dy <= m && y - dy >= m; ++dy) {
+                const std::vector<MaskSpan>& a = img.spans[y];
+                const std::vector<MaskSpan>& b = img.spans[y - dy];
+                int k = m - dy;
+                for (size_t i = 0, j = 0; i < a.size() && j < b.size();) {
+                    if (a[i].x0 - k < b[j].x1 && b[j].x0 < a[i].x1 + k && (dy > 0 || i != j))
+                        unite(first[y] + (int)i, first[y - dy] + (int)j);
+                    if (a[i].x1 < b[j].x1) ++i;
+                    else ++j;
+                }
+            }
+
+        std::vector<int> index(first[h], -1);
+        holes.clear();
+        for (int y = m; y < h - m; ++y)
+            for (size_t i = 0; i < img.spans[y].size(); ++i) {
+                int root = find(parent, first[y] + (int)i);
+                if (index[root] < 0) {
+                    index[root] = (int)holes.size();
+                    holes.emplace_back();
+                    holes.back().y0 = y - m;
+                    holes.back().settled = true;
+                }
+                Hole& hole = holes[index[root]];
+                MaskSpan s = img.spans[y][i];
+                s.x0 = std::max(s.x0, m);
+                s.x1 = std::min(s.x1, w - m);
+                if (s.x0 >= s.x1) continue;
+                hole.spans.resize(y - hole.y0 + 1 + m);
+                hole.spans[y - hole.y0].push_back(s);
+                hole.pixels += s.x1 - s.x0;
+                for (int x = s.x0; x < s.x1 && hole.settled; ++x) hole.settled = settled[y * w + x];
+            }
+
+        // Same-row runs reach each other through the widened overlap, so a row's runs stay sorted
+        for (Hole& hole : holes) {
+            int x0 = w, x1 = 0, rows = 0;
+            for (int y = 0; y < (int)hole.spans.size(); ++y) {
+                if (hole.spans[y].empty()) continue;
+                x0 = std::min(x0, hole.spans[y].front().x0);
+                x1 = std::max(x1, hole.spans[y].back().x1);
+                rows = y;
+            }
+            hole.width = std::max(x1 - x0, rows - m + 1);
+            hole.residual = 0.0;
+        }
+        activeCount = 0;
+        for (const Hole& hole : holes) activeCount += !hole.settled;
+        stale = false;
+        labelledBiharmonic = biharmonic;
+    }
+
+    template <class T>
+    void sweep(Image<T>& img, Hole& hole, double omega, bool banded) {
+        int base = hole.y0 * img.w;
+        SweepGrid<T> g = {img.w, (int)hole.spans.size(), &hole.spans, img.mask.data() + base,
+                          {img.r.data() + base, img.g.data() + base, img.b.data() + base}, {nullptr, nullptr, nullptr},
+                          biharmonic, omega, biharmonic};
+        int m = biharmonic ? 2 : 1;
+        hole.swept = 0;
+        for (int k = 0; k < hole.quota; ++k) {
+            // The grid lists this hole's runs only. Pixels of other holes between them on the
+            // same rows have their own quota or have retired, so only the runs are relaxed.
+            if (banded) {
+                sweepColoured(g, true);
+            } else {
+                for (int colour = 0; colour < sweepColours(biharmonic); ++colour) relaxRuns(g, colour, m, g.h - m);
+            }
+            ++hole.swept;
+        }
+        // One residual per round costs about a sweep; the sweeps do not need their change
+        hole.residual = relativeResidual(g);
+    }
+};
+
+// 3. MULTIGRID SOLVER (V-cycle)
+// Same equations as above, but the error is smoothed on a pyramid of coarser grids so that
+// low frequencies settle in a few cycles instead of thousands of sweeps.
+// Every level solves A u = f in unscaled stencil form:
+//   Laplace:    A u = 4u - Sum(N)
+//   Biharmonic: A u = 20u - 8*Sum(N) + 2*Sum(D) + Sum(F)
+// The finest level is the image itself (f = 0), coarser levels hold corrections.
+template <class T>
+struct MultigridLevel {
+    int w = 0, h = 0;
+    std::vector<T> u[3];         // correction for r, g, b, zero outside the unknown cells
+    std::vector<T> f[3];         // restricted residual
+    std::vector<uint8_t> mask;   // 1 = unknown
+    SpanRows spans;              // unknown cells
+};
+
+// Runs where both rows are masked, shrunk to whole 2x2 blocks, give the coarse row
+void coarsenSpans(const std::vector<MaskSpan>& a, const std::vector<MaskSpan>& b, std::vector<MaskSpan>& out) {
+    out.clear();
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        int x0 = std::max(a[i].x0, b[j].x0);
+        int x1 = std::min(a[i].x1, b[j].x1);
+        int X0 = (x0 + 1) / 2;
+        int X1 = x1 / 2;
+        if (X0 < X1) out.push_back({X0, X1});
+        if (a[i].x1 < b[j].x1) ++i; else ++j;
+    }
+}
+
+template <class T>
+class Multigrid {
+public:
+    bool biharmonic = false;
+    int preSmooth = 2;
+    int postSmooth = 2;
+    int coarseSweeps = 50;
+
+    // One V-cycle over all three channels. Returns the relative residual on the image after it;
+    // the change of the last smoothing sweep says little once the coarse grids do the work.
+    double vcycle(Image<T>& img) {
+        build(img);
+        T* u[3] = {img.r.data(), img.g.data(), img.b.data()};
+        cycle(0, img.w, img.h, img.spans, img.mask.data(), u, nullptr);
+        SweepGrid<T> g = {img.w, img.h, &img.spans, img.mask.data(), {u[0], u[1], u[2]}, {nullptr, nullptr, nullptr},
+                          biharmonic, 1.0, false};
+        return relativeResidual(g);
+    }
+
+private:
+    std::vector<MultigridLevel<T>> levels;    // levels[0] is one step coarser than the image
+    std::vector<T> correction;                // prolonged correction of one channel, all zero between uses
+
+    int margin() const { return biharmonic ? 2 : 1; }
+
+    void build(Image<T>& img) {
+        int w = img.w, h = img.h;
+        size_t n = 0;
+        while (std::min(w, h) >= 16) {
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+            if (levels.size() <= n) levels.emplace_back();
+            MultigridLevel<T>& lv = levels[n++];
+            if (lv.w != w || lv.h != h) {
+                lv.w = w;
+                lv.h = h;
+                for (int c = 0; c < 3; ++c) {
+                    lv.u[c].assign(w * h, 0);
+                    lv.f[c].assign(w * h, 0);
+                }
+                lv.mask.assign(w * h, 0);
+                lv.spans.assign(h, {});
+            }
+        }
+        levels.resize(n);
+        correction.resize(img.w * img.h, 0);
+
+        // A coarse cell is unknown only when all of its fine children are. Letting partially known
+        // cells float moves the coarse boundary outwards and the corrections overshoot.
+        const SpanRows* fine = &img.spans;
+        for (MultigridLevel<T>& lv : levels) {
+            for (int y = 0; y < lv.h; ++y) {
+                uint8_t* row = lv.mask.data() + y * lv.w;
+                for (const MaskSpan& sp : lv.spans[y]) std::fill(row + sp.x0, row + sp.x1, 0);
+                if (2 * y + 1 < (int)fine->size()) {
+                    coarsenSpans((*fine)[2 * y], (*fine)[2 * y + 1], lv.spans[y]);
+                } else {
+                    lv.spans[y].clear();
+                }
+                for (const MaskSpan& sp : lv.spans[y]) std::fill(row + sp.x0, row + sp.x1, 1);
+            }
+            fine = &lv.spans;
+        }
+    }
+
+    // Stencil A applied to v at idx
+    double apply(const T* v, int idx, int w) const {
+        double sum_n = v[idx - w] + v[idx + w] + v[idx - 1] + v[idx + 1];
+        if (!biharmonic) return 4.0 * v[idx] - sum_n;
+        double sum_d = v[idx - w - 1] + v[idx - w + 1] + v[idx + w - 1] + v[idx + w + 1];
+        double sum_f = v[idx - 2 * w] + v[idx + 2 * w] + v[idx - 2] + v[idx + 2];
+        return 20.0 * v[idx] - 8.0 * sum_n + 2.0 * sum_d + sum_f;
+    }
+
+    // Red-black / five-colour Gauss-Seidel relaxation of A u = f (f == nullptr means f = 0)
+    double smooth(int w, int h, const SpanRows& spans, const uint8_t* mask, T** u, T** f, int sweeps) {
+        SweepGrid<T> g = {w, h, &spans, mask, {u[0], u[1], u[2]}, {nullptr, nullptr, nullptr}, biharmonic, 1.0, false};
+        if (f) std::copy(f, f + 3, g.f);
+        double change = 0.0;
+        for (int s = 0; s < sweeps; ++s) change = sweepColoured(g);
+        return change;
+    }
+
+    // r = f - A u, averaged over the 2x2 children of every unknown coarse cell
+    void restrictResidual(int w, int h, T** u, T** f, MultigridLevel<T>& coarse) {
+        int m = margin();
+        // Operator scales with h^2 (Laplace) or h^4 (Biharmonic); averaging 4 children adds 1/4
+        double scale = biharmonic ? 16.0 / 4.0 : 4.0 / 4.0;
+        for (int Y = 0; Y < coarse.h; ++Y) {
+            for (const MaskSpan& sp : coarse.spans[Y]) {
+                for (int X = sp.x0; X < sp.x1; ++X) {
+                    int cidx = Y * coarse.w + X;
+                    for (int c = 0; c < 3; ++c) {
+                        double sum = 0.0;
+                        for (int y = 2 * Y; y < 2 * Y + 2; ++y) {
+                            for (int x = 2 * X; x < 2 * X + 2; ++x) {
+                                if (y < m || y >= h - m || x < m || x >= w - m) continue;
+                                int idx = y * w + x;
+                                sum += (f ? f[c][idx] : 0.0) - apply(u[c], idx, w);
+                            }
+                        }
+                        coarse.f[c][cidx] = sum * scale;
+                    }
+                }
+            }
+        }
+    }
+
+    // Bilinear (cell-centred) interpolation of the coarse correction, added to unknown fine cells.
+    // The rediscretised biharmonic coarse operator does not match the fine one well enough and
+    // plain correction overshoots, so the step length is chosen to minimise the error energy:
+    //   alpha = <p, r> / <p, A p>
+    // which can never make the fine error worse.
+    void prolongAdd(const MultigridLevel<T>& coarse, int w, int h, const SpanRows& spans, T** u,
+                    T** f) {
+        int m = margin();
+        for (int c = 0; c < 3; ++c) {
+            const std::vector<T>& e = coarse.u[c];
+            for (int y = m; y < h - m; ++y) {
+                int Y = y / 2;
+                int Y2 = std::clamp(Y + ((y & 1) ? 1 : -1), 0, coarse.h - 1);
+                for (const MaskSpan& sp : spans[y]) {
+                    for (int x = std::max(sp.x0, m); x < std::min(sp.x1, w - m); ++x) {
+                        int X = x / 2;
+                        int X2 = std::clamp(X + ((x & 1) ? 1 : -1), 0, coarse.w - 1);
+                        correction[y * w + x] = (9.0 * e[Y * coarse.w + X] + 3.0 * e[Y * coarse.w + X2] +
+                                                 3.0 * e[Y2 * coarse.w + X] + 1.0 * e[Y2 * coarse.w + X2]) / 16.0;
+                    }
+                }
+            }
+
+            double pr = 0.0, pap = 0.0;
+            for (int y = m; y < h - m; ++y) {
+                for (const MaskSpan& sp : spans[y]) {
+                    for (int x = std::max(sp.x0, m); x < std::min(sp.x1, w - m); ++x) {
+                        int idx = y * w + x;
+                        double r = (f ? f[c][idx] : 0.0) - apply(u[c], idx, w);
+                        pr += correction[idx] * r;
+                        pap += correction[idx] * apply(correction.data(), idx, w);
+                    }
+                }
+            }
+            double alpha = pap > 0.0 ? pr / pap : 0.0;
+            for (int y = m; y < h - m; ++y) {
+                for (const MaskSpan& sp : spans[y]) {
+                    for (int x = std::max(sp.x0, m); x < std::min(sp.x1, w - m); ++x) {
+                        int idx = y * w + x;
+                        u[c][idx] += alpha * correction[idx];
+                        correction[idx] = 0;
+                    }
+                }
+            }
+        }
+    }
+
+    void cycle(size_t level, int w, int h, const SpanRows& spans, const uint8_t* mask, T** u, T** f) {
+        if (level == levels.size()) {
+            smooth(w, h, spans, mask, u, f, coarseSweeps);
+            return;
+        }
+        MultigridLevel<T>& coarse = levels[level];
+        // Gauss-Seidel smooths the 13-point stencil much more slowly, so it gets twice the sweeps
+        int k = biharmonic ? 2 : 1;
+        smooth(w, h, spans, mask, u, f, k * preSmooth);
+        restrictResidual(w, h, u, f, coarse);
+
+        T* cu[3] = {coarse.u[0].data(), coarse.u[1].data(), coarse.u[2].data()};
+        T* cf[3] = {coarse.f[0].data(), coarse.f[1].data(), coarse.f[2].data()};
+        cycle(level + 1, coarse.w, coarse.h, coarse.spans, coarse.mask.data(), cu, cf);
+
+        prolongAdd(coarse, w, h, spans, u, f);
+        smooth(w, h, spans, mask, u, f, k * postSmooth);
+
+        // Leave the coarse correction zero for the next cycle, whose mask may differ
+        for (int Y = 0; Y < coarse.h; ++Y)
+            for (const MaskSpan& sp : coarse.spans[Y])
+                for (int c = 0; c < 3; ++c)
+                    std::fill(cu[c] + Y * coarse.w + sp.x0, cu[c] + Y * coarse.w + sp.x1, 0);
+    }
+};
+
+// Direct solve of the masked system with preconditioned conjugate gradients. The operator is
+// assembled over the pixels the sweeps relax, with known neighbours moved to the right-hand
+// side. It is symmetric positive definite for both stencils, so plain CG applies; the three
+// channels share the matrix and preconditioner and run their own recurrences side by side.
+class ConjugateGradient {
+public:
+    bool biharmonic = false;
+    bool incompleteCholesky = true;    // IC(0) preconditioner, false = Jacobi
+    double tolerance = 1e-6;           // on |b - A x| relative to |b|
+    int maxIterations = 20000;
+
+    int iterations = 0;
+    double residual = 0.0;             // largest relative residual of the three channels, as written
+
+    // Solves all three channels in place and returns the number of iterations
+    template <class T>
+    int solve(Image<T>& img) {
+        assemble(img);
+        factor();
+        size_t n = pixel.size();
+        std::vector<double> x(3 * n), b(3 * n), r(3 * n), z(3 * n), p(3 * n), q(3 * n);
+        T* u[3] = {img.r.data(), img.g.data(), img.b.data()};
+        for (size_t i = 0; i < n; ++i)
+            for (int c = 0; c < 3; ++c) {
+                x[3 * i + c] = u[c][pixel[i]];
+                b[3 * i + c] = rhs[3 * i + c];
+            }
+
+        multiply(x, q);
+        for (size_t i = 0; i < 3 * n; ++i) r[i] = b[i] - q[i];
+        precondition(r, z);
+        p = z;
+        double bnorm[3], rz[3];
+        bool done[3];
+        dots(b, b, bnorm);
+        dots(r, z, rz);
+        for (int c = 0; c < 3; ++c) bnorm[c] = std::max(std::sqrt(bnorm[c]), 1e-30);
+
+        for (iterations = 0; iterations < maxIterations; ++iterations) {
+            double rr[3];
+            dots(r, r, rr);
+            residual = 0.0;
+            for (int c = 0; c < 3; ++c) {
+                double rel = std::sqrt(rr[c]) / bnorm[c];
+                done[c] = rel < tolerance;
+                residual = std::max(residual, rel);
+            }
+            if (done[0] && done[1] && done[2]) break;
+
+            multiply(p, q);
+            double pq[3], alpha[3];
+            dots(p, q, pq);
+            for (int c = 0; c < 3; ++c) alpha[c] = done[c] || pq[c] <= 0.0 ? 0.0 : rz[c] / pq[c];
+            for (size_t i = 0; i < n; ++i)
+                for (int c = 0; c < 3; ++c) {
+                    x[3 * i + c] += alpha[c] * p[3 * i + c];
+                    r[3 * i + c] -= alpha[c] * q[3 * i + c];
+                }
+            precondition(r, z);
+            double rzNext[3];
+            dots(r, z, rzNext);
+            for (int c = 0; c < 3; ++c) {
+                double beta = rz[c] > 0.0 ? rzNext[c] / rz[c] : 0.0;
+                rz[c] = rzNext[c];
+                for (size_t i = 0; i < n; ++i) p[3 * i + c] = z[3 * i + c] + beta * p[3 * i + c];
+            }
+        }
+
+        for (size_t i = 0; i < n; ++i)
+            for (int c = 0; c < 3; ++c) {
+                double value = x[3 * i + c];
+                u[c][pixel[i]] = (T)(biharmonic ? std::clamp(value, 0.0, 255.0) : value);
+            }
+        // Clamping and rounding to the planes move the result off the one the recurrence
+        // converged to, so the residual reported is that of the image as written, measured
+        // the way the sweeps measure theirs
+        residual = relativeResidual(imageGrid(img, biharmonic, 1.0));
+        return iterations;
+    }
+
+private:
+    std::vector<int> pixel;            // image index of every unknown
+    std::vector<int> rowPtr, col;      // A in CSR form, columns ascending
+    std::vector<double> val;
+    std::vector<int> diagPos;          // position of A(i, i) in val
+    std::vector<double> lower;         // IC(0) factor L on the lower half of A's pattern, or 1 / A(i, i)
+    std::vector<double> rhs;           // known neighbours of every unknown, three channels interleaved
+
+    template <class T>
+    void assemble(Image<T>& img) {
+        int w = img.w, h = img.h;
+        int m = biharmonic ? 2 : 1;
+        std::vector<int> number(w * h, -1);
+        pixel.clear();
+        for (int y = m; y < h - m; ++y)
+            for (const MaskSpan& s : img.spans[y])
+                for (int x = std::max(s.x0, m); x < std::min(s.x1, w - m); ++x) {
+                    number[y * w + x] = (int)pixel.size();
+                    pixel.push_back(y * w + x);
+                }
+
+        // The stencils of solveLaplaceStep and solveBiharmonicStep in A u = 0 form, in the
+        // order of increasing image index so that every row comes out sorted
+        struct Tap { int dx, dy; double weight; };
+        static const Tap laplace[] = {{0, -1, -1}, {-1, 0, -1}, {0, 0, 4}, {1, 0, -1}, {0, 1, -1}};
+        static const Tap bilaplace[] = {
+            {0, -2, 1}, {-1, -1, 2}, {0, -1, -8}, {1, -1, 2}, {-2, 0, 1}, {-1, 0, -8}, {0, 0, 20},
+            {1, 0, -8}, {2, 0, 1}, {-1, 1, 2}, {0, 1, -8}, {1, 1, 2}, {0, 2, 1}};
+        const Tap* taps = biharmonic ? bilaplace : laplace;
+        int tapCount = biharmonic ? 13 : 5;
+
+        size_t n = pixel.size();
+        const T* u[3] = {img.r.data(), img.g.data(), img.b.data()};
+        rowPtr.assign(1, 0);
+        col.clear();
+        val.clear();
+        diagPos.resize(n);
+        rhs.assign(3 * n, 0.0);
+        for (size_t i = 0; i < n; ++i) {
+            int idx = pixel[i];
+            for (int t = 0; t < tapCount; ++t) {
+                int nb = idx + taps[t].dy * w + taps[t].dx;
+                if (number[nb] >= 0) {
+                    if (number[nb] == (int)i) diagPos[i] = (int)val.size();
+                    col.push_back(number[nb]);
+                    val.push_back(taps[t].weight);
+                } else {
+                    for (int c = 0; c < 3; ++c) rhs[3 * i + c] -= taps[t].weight * u[c][nb];
+                }
+            }
+            rowPtr.push_back((int)col.size());
+        }
+    }
+
+    // Incomplete Cholesky without fill-in. The biharmonic matrix is not an M-matrix and IC(0)
+    // can meet vanishing or negative pivots; the diagonal is then shifted up until it does not.
+    // Near-zero pivots are refused too, as they wreck the conditioning of the preconditioner.
+    void factor() {
+        size_t n = pixel.size();
+        if (!incompleteCholesky) {
+            lower.resize(n);
+            for (size_t i = 0; i < n; ++i) lower[i] = 1.0 / val[diagPos[i]];
+            return;
+        }
+        for (double shift = 0.0;; shift = shift > 0.0 ? 2.0 * shift : 0.01) {
+            lower.assign(val.size(), 0.0);
+            bool ok = true;
+            for (size_t i = 0; i < n && ok; ++i) {
+                for (int a = rowPtr[i]; a <= diagPos[i]; ++a) {
+                    int k = col[a];
+                    // Sum of L(i, j) L(k, j) over the shared pattern with j < k
+                    double sum = 0.0;
+                    int ia = rowPtr[i], ka = rowPtr[k];
+                    while (ia < a && ka < diagPos[k]) {
+                        if (col[ia] == col[ka]) sum += lower[ia++] * lower[ka++];
+                        else if (col[ia] < col[ka]) ++ia;
+                        else ++ka;
+                    }
+                    if (a < diagPos[i]) {
+                        lower[a] = (val[a] - sum) / lower[diagPos[k]];
+                    } else {
+                        double pivot = val[a] * (1.0 + shift) - sum;
+                        if (pivot < 0.01 * val[a]) ok = false;
+                        else lower[a] = std::sqrt(pivot);
+                    }
+                }
+            }
+            if (ok) return;
+        }
+    }
+
+    // z = M^-1 r
+    void precondition(const std::vector<double>& r, std::vector<double>& z) const {
+        size_t n = pixel.size();
+        if (!incompleteCholesky) {
+            for (size_t i = 0; i < n; ++i)
+                for (int c = 0; c < 3; ++c) z[3 * i + c] = r[3 * i + c] * lower[i];
+            return;
+        }
+        // L y = r, then L^T z = y, walking the rows of L as the columns of L^T
+        for (size_t i = 0; i < n; ++i)
+            for (int c = 0; c < 3; ++c) {
+                double sum = r[3 * i + c];
+                for (int a = rowPtr[i]; a < diagPos[i]; ++a) sum -= lower[a] * z[3 * col[a] + c];
+                z[3 * i + c] = sum / lower[diagPos[i]];
+            }
+        for (size_t i = n; i-- > 0;)
+            for (int c = 0; c < 3; ++c) {
+                z[3 * i + c] /= lower[diagPos[i]];
+                for (int a = rowPtr[i]; a < diagPos[i]; ++a) z[3 * col[a] + c] -= lower[a] * z[3 * i + c];
+            }
+    }
+
+    // q = A p
+    void multiply(const std::vector<double>& p, std::vector<double>& q) const {
+        size_t n = pixel.size();
+        for (size_t i = 0; i < n; ++i) {
+            double sum[3] = {0.0, 0.0, 0.0};
+            for (int a = rowPtr[i]; a < rowPtr[i + 1]; ++a)
+                for (int c = 0; c < 3; ++c) sum[c] += val[a] * p[3 * col[a] + c];
+            for (int c = 0; c < 3; ++c) q[3 * i + c] = sum[c];
+        }
+    }
+
+    void dots(const std::vector<double>& a, const std::vector<double>& b, double* out) const {
+        out[0] = out[1] = out[2] = 0.0;
+        for (size_t i = 0; i < a.size(); i += 3)
+            for (int c = 0; c < 3; ++c) out[c] += a[i + c] * b[i + c];
+    }
+};
+
+// Exemplar inpainting: the hole is filled with texture copied from the known region rather than
+// diffused into it. Every pixel whose patch overlaps the hole is matched to a patch that lies
+// entirely outside the hole, using a PatchMatch nearest-neighbour field (propagation of good
+// matches to neighbours plus random search around them), and each hole pixel then becomes the
+// average of what the patches covering it vote for. The two steps alternate on an image
+// pyramid from coarse to fine, the field of each level seeding the next one.
+class PatchMatch {
+public:
+    int patchRadius = 3;         // 7x7 patches
+    int emIterations = 4;        // match and vote rounds per level, twice as many on the coarsest
+    int searchIterations = 2;    // propagation and random search passes per round
+
+    int levels = 0;              // pyramid depth of the last run
+
+    // Fills the hole of img in place and returns the largest change to a masked pixel
+    template <class T>
+    double inpaint(Image<T>& img) {
+        int x0 = img.w, y0 = img.h, x1 = 0, y1 = 0;
+        for (int y = 0; y < img.h; ++y)
+            if (!img.spans[y].empty()) {
+                x0 = std::min(x0, img.spans[y].front().x0);
+                x1 = std::max(x1, img.spans[y].back().x1);
+                y0 = std::min(y0, y);
+                y1 = y + 1;
+            }
+        levels = 0;
+        if (x0 >= x1) return 0.0;
+
+        // Texture is taken from around the hole, up to the hole's own size away from it
+        int margin = std::max(x1 - x0, y1 - y0) + patchRadius;
+        int cx0 = std::max(x0 - margin, 0), cy0 = std::max(y0 - margin, 0);
+        int cx1 = std::min(x1 + margin, img.w), cy1 = std::min(y1 + margin, img.h);
+
+        // Matching works on a float copy of the region, whatever the planes hold
+        std::vector<Level> pyramid(1);
+        FloatImage& base = pyramid[0].image;
+        base.init(cx1 - cx0, cy1 - cy0);
+        for (int y = cy0; y < cy1; ++y) {
+            int from = y * img.w + cx0, to = (y - cy0) * base.w;
+            std::copy(&img.r[from], &img.r[from] + base.w, &base.r[to]);
+            std::copy(&img.g[from], &img.g[from] + base.w, &base.g[to]);
+            std::copy(&img.b[from], &img.b[from] + base.w, &base.b[to]);
+            std::copy(&img.mask[from], &img.mask[from] + base.w, &base.mask[to]);
+        }
+        base.updateSpans();
+        prepare(pyramid[0]);
+        if (pyramid[0].sources.empty()) return fillMask(img);    // no whole patch outside the hole
+
+        // Halve until the hole is a few patches across; a level without sources ends it early
+        int size = 2 * patchRadius + 1;
+        for (int extent = std::max(x1 - x0, y1 - y0); extent > 2 * size; extent = (extent + 1) / 2) {
+            const FloatImage& fine = pyramid.back().image;
+            if (std::min(fine.w, fine.h) < 8 * size) break;
+            Level coarse;
+            downsample(fine, coarse.image);
+            prepare(coarse);
+            if (coarse.sources.empty()) break;
+            pyramid.push_back(std::move(coarse));
+        }
+        levels = (int)pyramid.size();
+
+        unsigned seed = 1;
+        for (int l = levels - 1; l >= 0; --l) {
+            Level& level = pyramid[l];
+            if (l == levels - 1) {
+                fillMask(level.image);
+                for (size_t i = 0; i < level.nnf.size(); ++i)
+                    if (level.target[i]) level.nnf[i] = level.sources[random(seed) % level.sources.size()];
+            } else {
+                upsample(pyramid[l + 1], level, seed);
+                vote(level);
+            }
+            int rounds = l == levels - 1 ? 2 * emIterations : emIterations;
+            for (int round = 0; round < rounds; ++round) {
+                evaluate(level);
+                for (int pass = 0; pass < searchIterations; ++pass) search(level, pass % 2 == 0, seed++);
+                vote(level);
+            }
+        }
+
+        double change = 0.0;
+        const FloatImage& result = pyramid[0].image;
+        const Sample* from[3] = {result.r.data(), result.g.data(), result.b.data()};
+        T* to[3] = {img.r.data(), img.g.data(), img.b.data()};
+        for (int y = y0; y < y1; ++y)
+            for (const MaskSpan& s : img.spans[y])
+                for (int x = s.x0; x < s.x1; ++x)
+                    for (int c = 0; c < 3; ++c) {
+                        T& value = to[c][y * img.w + x];
+                        T next = from[c][(y - cy0) * result.w + x - cx0];
+                        change = std::max(change, (double)std::abs(next - value));
+                        value = next;
+                    }
+        img.markMaskDirty();
+        return change;
+    }
+
+private:
+    struct Level {
+        FloatImage image;
+        std::vector<uint8_t> target;    // the patch centred here overlaps the hole
+        std::vector<uint8_t> valid;     // the patch centred here lies inside the image and outside the hole
+        std::vector<int> sources;       // every valid centre, for random initialisation
+        std::vector<int> nnf;           // best valid centre found for every target
+        std::vector<float> cost;        // its sum of squared differences
+        int y0 = 0, y1 = 0;             // rows holding targets
+    };
+
+    static unsigned random(unsigned& state) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // Targets are the mask dilated by the patch radius, sources the centres it leaves out
+    void prepare(Level& level) const {
+        const FloatImage& im = level.image;
+        int w = im.w, h = im.h, r = patchRadius;
+        std::vector<int> rows(w * h), prefix(std::max(w, h) + 1);
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) prefix[x + 1] = prefix[x] + im.mask[y * w + x];
+            for (int x = 0; x < w; ++x) rows[y * w + x] = prefix[std::min(x + r + 1, w)] - prefix[std::max(x - r, 0)];
+        }
+        level.target.assign(w * h, 0);
+        level.valid.assign(w * h, 0);
+        level.sources.clear();
+        level.y0 = h;
+        level.y1 = 0;
+        for (int x = 0; x < w; ++x) {
+            for (int y = 0; y < h; ++y) prefix[y + 1] = prefix[y] + rows[y * w + x];
+            for (int y = 0; y < h; ++y) {
+                int i = y * w + x;
+                level.target[i] = prefix[std::min(y + r + 1, h)] - prefix[std::max(y - r, 0)] > 0;
+                if (level.target[i]) {
+                    level.y0 = std::min(level.y0, y);
+                    level.y1 = std::max(level.y1, y + 1);
+                }
+                level.valid[i] = !level.target[i] && x >= r && x < w - r && y >= r && y < h - r;
+            }
+        }
+        for (int i = 0; i < w * h; ++i)
+            if (level.valid[i]) level.sources.push_back(i);
+        level.nnf.assign(w * h, -1);
+        level.cost.assign(w * h, 0.0f);
+    }
+
+    // Box-filters the known pixels; a coarse pixel is masked if any pixel under it is
+    static void downsample(const FloatImage& fine, FloatImage& coarse) {
+        coarse.init((fine.w + 1) / 2, (fine.h + 1) / 2);
+        const Sample* from[3] = {fine.r.data(), fine.g.data(), fine.b.data()};
+        Sample* to[3] = {coarse.r.data(), coarse.g.data(), coarse.b.data()};
+        for (int Y = 0; Y < coarse.h; ++Y)
+            for (int X = 0; X < coarse.w; ++X) {
+                double sum[3] = {0.0, 0.0, 0.0};
+                int known = 0, masked = 0;
+                for (int y = 2 * Y; y < std::min(2 * Y + 2, fine.h); ++y)
+                    for (int x = 2 * X; x < std::min(2 * X + 2, fine.w); ++x) {
+                        int i = y * fine.w + x;
+                        if (fine.mask[i]) { ++masked; continue; }
+                        for (int c = 0; c < 3; ++c) sum[c] += from[c][i];
+                        ++known;
+                    }
+                int I = Y * coarse.w + X;
+                for (int c = 0; c < 3; ++c) to[c][I] = known ? (Sample)(sum[c] / known) : 0;
+                coarse.mask[I] = masked > 0;
+            }
+        coarse.updateSpans();
+    }
+
+    // Sum of squared differences between the patches at target t and source s, giving up once
+    // it passes limit. Target patches are clamped at the image edge; source patches never cross it.
+    float distance(const FloatImage& im, int t, int s, float limit) const {
+        int w = im.w, h = im.h, r = patchRadius;
+        int tx = t % w, ty = t / w, sx = s % w, sy = s / w;
+        const Sample* planes[3] = {im.r.data(), im.g.data(), im.b.data()};
+        float sum = 0.0f;
+        for (int dy = -r; dy <= r; ++dy) {
+            int row = std::clamp(ty + dy, 0, h - 1) * w;
+            int srow = (sy + dy) * w + sx;
+            for (int dx = -r; dx <= r; ++dx) {
+                int a = row + std::clamp(tx + dx, 0, w - 1), b = srow + dx;
+                for (int c = 0; c < 3; ++c) {
+                    float d = (float)(planes[c][a] - planes[c][b]);
+                    sum += d * d;
+                }
+            }
+            if (sum >= limit) return sum;
+        }
+        return sum;
+    }
+
+    // Splits the target rows into bands, one task each
+    void forBands(const Level& level, const std::function<void(int, int, int)>& fn) const {
+        int rows = level.y1 - level.y0;
+        if (rows <= 0) return;
+        int bands = serialSweeps ? 1 : std::min(4 * sweepPool().size(), rows);
+        auto run = [&](int band) {
+            fn(band, level.y0 + rows * band / bands, level.y0 + rows * (band + 1) / bands);
+        };
+        if (bands == 1) run(0);
+        else sweepPool().parallelFor(bands, run);
+    }
+
+    void evaluate(Level& level) const {
+        int w = level.image.w;
+        forBands(level, [&](int, int y0, int y1) {
+            for (int i = y0 * w; i < y1 * w; ++i)
+                if (level.target[i]) level.cost[i] = distance(level.image, i, level.nnf[i], INFINITY);
+        });
+    }
+
+    // One PatchMatch pass, forward or backward in scanline order. Bands run concurrently, so a
+    // match only propagates from neighbours in the same band; random search carries it across.
+    void search(Level& level, bool forward, unsigned seed) const {
+        const FloatImage& im = level.image;
+        int w = im.w, h = im.h, r = patchRadius;
+        forBands(level, [&](int band, int y0, int y1) {
+            unsigned state = seed * 2654435761u + band * 40503u + 1;
+            auto attempt = [&](int i, int sx, int sy) {
+                if (sx < r || sy < r || sx >= w - r || sy >= h - r) return;
+                int s = sy * w + sx;
+                if (!level.valid[s] || s == level.nnf[i]) return;
+                float cost = distance(im, i, s, level.cost[i]);
+                if (cost < level.cost[i]) {
+                    level.cost[i] = cost;
+                    level.nnf[i] = s;
+                }
+            };
+            int dir = forward ? 1 : -1;
+            for (int k = 0; k < y1 - y0; ++k) {
+                int y = forward ? y0 + k : y1 - 1 - k;
+                for (int j = 0; j < w; ++j) {
+                    int x = forward ? j : w - 1 - j;
+                    int i = y * w + x;
+                    if (!level.target[i]) continue;
+                    // The neighbour already visited in this pass, shifted by one
+                    int px = x - dir, py = y - dir;
+                    if (px >= 0 && px < w && level.target[i - dir]) {
+                        int s = level.nnf[i - dir];
+                        attempt(i, s % w + dir, s / w);
+                    }
+                    if (py >= y0 && py < y1 && level.target[i - dir * w]) {
+                        int s = level.nnf[i - dir * w];
+                        attempt(i, s % w, s / w + dir);
+                    }
+                    // Random search in exponentially shrinking windows around the best match
+                    for (int radius = std::max(w, h); radius >= 1; radius /= 2) {
+                        int s = level.nnf[i];
+                        int sx = s % w + (int)(random(state) % (2 * radius + 1)) - radius;
+                        int sy = s / w + (int)(random(state) % (2 * radius + 1)) - radius;
+                        attempt(i, std::clamp(sx, r, w - r - 1), std::clamp(sy, r, h - r - 1));
+                    }
+                }
+            }
+        });
+    }
+
+    // Every hole pixel becomes the mean of the source pixels the patches covering it map it to.
+    // Sources lie outside the hole, so the vote only reads pixels it never writes.
+    void vote(Level& level) const {
+        FloatImage& im = level.image;
+        int w = im.w, h = im.h, r = patchRadius;
+        Sample* planes[3] = {im.r.data(), im.g.data(), im.b.data()};
+        forBands(level, [&](int, int y0, int y1) {
+            for (int y = y0; y < y1; ++y)
+                for (const MaskSpan& s : im.spans[y])
+                    for (int x = s.x0; x < s.x1; ++x) {
+                        double sum[3] = {0.0, 0.0, 0.0};
+                        int votes = 0;
+                        for (int dy = -r; dy <= r; ++dy) {
+                            if (y - dy < 0 || y - dy >= h) continue;
+                            for (int dx = -r; dx <= r; ++dx) {
+                                if (x - dx < 0 || x - dx >= w) continue;
+                                int source = level.nnf[(y - dy) * w + x - dx] + dy * w + dx;
+                                for (int c = 0; c < 3; ++c) sum[c] += planes[c][source];
+                                ++votes;
+                            }
+                        }
+                        for (int c = 0; c < 3; ++c) planes[c][y * w + x] = (Sample)(sum[c] / votes);
+                    }
+        });
+    }
+
+    // Seeds a level's field from the coarser one, doubling the offsets
+    void upsample(const Level& coarse, Level& fine, unsigned& seed) const {
+        int w = fine.image.w, h = fine.image.h, cw = coarse.image.w, r = patchRadius;
+        for (int y = 0; y < h; ++y)
+            for (int x = 0; x < w; ++x) {
+                int i = y * w + x;
+                if (!fine.target[i]) continue;
+                int c = (y / 2) * cw + x / 2;
+                int s = -1;
+                if (coarse.target[c]) {
+                    int sx = 2 * (coarse.nnf[c] % cw) + x % 2, sy = 2 * (coarse.nnf[c] / cw) + y % 2;
+                    if (sx >= r && sy >= r && sx < w - r && sy < h - r && fine.valid[sy * w + sx]) s = sy * w + sx;
+                }
+                fine.nnf[i] = s >= 0 ? s : fine.sources[random(seed) % fine.sources.size()];
+            }
+    }
+};
+
+enum SolveMethod { METHOD_SOR, METHOD_MULTIGRID, METHOD_CG, METHOD_FILL, METHOD_MARCH, METHOD_PATCH };
+
+// Runs a solver to SOLVE_TOLERANCE (the CG tolerance for METHOD_CG) on an image whose hole was
+// already filled by loadMask, or until SOLVE_MAX_SWEEPS; change is then the residual it got to.
+// Returns the sweeps, cycles or iterations it took.
+template <class T>
+long long solveImage(Image<T>& image, SolveMethod method, bool biharmonic, double& change) {
+    long long sweeps = 0;
+    change = 0.0;
+    if (method == METHOD_CG) {
+        ConjugateGradient cg;
+        cg.biharmonic = biharmonic;
+        sweeps = cg.solve(image);
+        change = cg.residual;
+    } else if (method == METHOD_MARCH) {
+        fastMarch(image);
+        sweeps = 1;
+    } else if (method == METHOD_PATCH) {
+        PatchMatch patchMatch;
+        change = patchMatch.inpaint(image);
+        sweeps = patchMatch.levels;
+    } else if (method == METHOD_SOR) {
+        HoleScheduler scheduler;
+        scheduler.biharmonic = biharmonic;
+        do {
+            change = scheduler.round(image);
+            sweeps += scheduler.lastSweeps();
+        } while (scheduler.active() > 0 && sweeps < SOLVE_MAX_SWEEPS);
+    } else if (method != METHOD_FILL) {
+        Multigrid<T> multigrid;
+        multigrid.biharmonic = biharmonic;
+        do {
+            change = multigrid.vcycle(image);
+            ++sweeps;
+        } while (change >= SOLVE_TOLERANCE && sweeps < SOLVE_MAX_SWEEPS / 100);
+    }
+    return sweeps;
+}
+
+const char* sweepName(SolveMethod method) {
+    return method == METHOD_CG ? " iterations" : method == METHOD_MULTIGRID ? " cycles" : method == METHOD_PATCH ? " levels" : " sweeps";
+}
+
+// Headless batch mode: every manifest line names an image, its mask and optionally the output
+// ("image mask [output]", # starts a comment). Images are solved to SOLVE_TOLERANCE on a pool of
+// workers, one image per worker, without a window or renderer.
+
+struct BatchJob {
+    std::string image, mask, output;
+};
+
+int runBatch(const std::string& manifestPath, SolveMethod method, bool biharmonic, int threads) {
+    std::vector<BatchJob> jobs;
+    std::ifstream manifest(manifestPath);
+    if (!manifest) {
+        std::cerr << "Could not open manifest '" << manifestPath << "'" << std::endl;
+        return 1;
+    }
+    std::string line;
+    while (std::getline(manifest, line)) {
+        std::istringstream fields(line.substr(0, line.find('#')));
+        BatchJob job;
+        if (!(fields >> job.image)) continue;
+        if (!(fields >> job.mask)) {
+            std::cerr << "Manifest line without a mask: " << job.image << std::endl;
+            continue;
+        }
+        if (!(fields >> job.output)) job.output = job.image.substr(0, job.image.rfind('.')) + "_inpainted.png";
+        jobs.push_back(job);
+    }
+
+    std::mutex logMutex;
+    std::atomic<int> failed{0};
+    std::atomic<long long> pixels{0};
+    ThreadPool pool(std::max(1, std::min(threads, (int)jobs.size())));
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    pool.parallelFor((int)jobs.size(), [&](int i) {
+        const BatchJob& job = jobs[i];
+        serialSweeps = pool.size() > 1;
+        Uint64 jobStart = SDL_GetPerformanceCounter();
+        YcbcrImage image;
+        FloatImage mask;
+        if (!loadImage(job.image, image) || !loadImage(job.mask, mask) || mask.w != image.w || mask.h != image.h) {
+            std::lock_guard<std::mutex> lock(logMutex);
+            std::cerr << job.image << ": could not load the image and a mask of the same size" << std::endl;
+            ++failed;
+            return;
+        }
+        loadMask(image, mask);
+
+        double change;
+        long long sweeps = solveImage(image, method, biharmonic, change);
+        saveImage(image, job.output);
+
+        double seconds = (double)(SDL_GetPerformanceCounter() - jobStart) / SDL_GetPerformanceFrequency();
+        long long count = (long long)image.w * image.h;
+        pixels += count;
+        std::lock_guard<std::mutex> lock(logMutex);
+        std::cout << job.image << " -> " << job.output << ": " << image.w << "x" << image.h << ", " << sweeps
+                  << sweepName(method)
+                  << ", " << (method == METHOD_FILL || method == METHOD_MARCH || method == METHOD_PATCH ? "max change " : "residual ")
+                  << change << ", " << seconds
+                  << " s, " << count / seconds / 1e6 << " Mpixel/s" << std::endl;
+    });
 
-class Image {
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    std::cout << jobs.size() - failed << " of " << jobs.size() << " images in " << seconds << " s on "
+              << pool.size() << " workers, " << pixels / seconds / 1e6 << " Mpixel/s" << std::endl;
+    return failed ? 1 : 0;
+}
+
+// Raw tile store for canvases larger than memory. A 64-byte header ("INPTILES", then width,
+// height and tile size as int32) is followed by the tiles in row-major order. Each tile holds
+// its r, g and b planes as float32 and then its mask bytes (1 = masked), padded to the full
+// tile size at the right and bottom edges. Sizes and offsets are 64-bit, so stores may exceed
+// both 4 GB and the address space: every tile is mapped in a window of its own when first
+// touched and unmapped again by release(), which writes it back through the page cache.
+class TileStore {
 public:
-    int w, h;
-    std::vector<double> r, g, b;
-    std::vector<bool> mask;      // true = masked (missing), false = fixed
+    int w = 0, h = 0, tile = 0;
+    int tilesX = 0, tilesY = 0;
 
-    Image() : w(0), h(0) {}
+    ~TileStore() { close(); }
 
-    virtual void init(int width, int height) {
+    bool create(const std::string& path, int width, int height, int tileSize) {
         w = width;
         h = height;
-        r.assign(w * h, 0.0);
-        g.assign(w * h, 0.0);
-        b.assign(w * h, 0.0);
-        mask.assign(w * h, false);
+        tile = tileSize;
+        tilesX = (w + tile - 1) / tile;
+        tilesY = (h + tile - 1) / tile;
+        if (!openFile(path, true) || !resize(headerBytes + tileBytes() * tilesX * tilesY)) {
+            close();
+            return false;
+        }
+        uint8_t* header = mapWindow(0, headerBytes);
+        if (!header) {
+            close();
+            return false;
+        }
+        int32_t fields[3] = {w, h, tile};
+        std::memcpy(header, "INPTILES", 8);
+        std::memcpy(header + 8, fields, sizeof(fields));
+        unmapWindow(header, 0, headerBytes);
+        windows.assign((size_t)tilesX * tilesY, nullptr);
+        return true;
     }
 
-    virtual void fromSurface(SDL_Surface* surf)=0;
-    virtual void toSurface(SDL_Surface* surf) {
-        this->toPixels(surf->pixels, surf->pitch);
+    bool open(const std::string& path) {
+        if (!openFile(path, false)) return false;
+        uint8_t* header = size >= headerBytes ? mapWindow(0, headerBytes) : nullptr;
+        if (!header) {
+            close();
+            return false;
+        }
+        int32_t fields[3];
+        bool tagged = std::memcmp(header, "INPTILES", 8) == 0;
+        std::memcpy(fields, header + 8, sizeof(fields));
+        unmapWindow(header, 0, headerBytes);
+        w = fields[0];
+        h = fields[1];
+        tile = fields[2];
+        if (!tagged || w <= 0 || h <= 0 || tile <= 0) {
+            close();
+            return false;
+        }
+        tilesX = (w + tile - 1) / tile;
+        tilesY = (h + tile - 1) / tile;
+        if (size < headerBytes + tileBytes() * tilesX * tilesY) {
+            close();
+            return false;
+        }
+        windows.assign((size_t)tilesX * tilesY, nullptr);
+        return true;
     }
-    virtual void toTexture(SDL_Texture* tex) {
-        void* pixels = nullptr;
-        int pitch;
-        if (SDL_LockTexture(tex, NULL, &pixels, &pitch)) {
-            this->toPixels(pixels, pitch);
-            SDL_UnlockTexture(tex);
+
+    void close() {
+        release(0, 0, tilesX, tilesY);
+        windows.clear();
+#ifdef _WIN32
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) {
+            FlushFileBuffers(file);
+            CloseHandle(file);
+        }
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (fd >= 0) {
+            fsync(fd);
+            ::close(fd);
+        }
+        fd = -1;
+#endif
+        size = 0;
+    }
+
+    float* plane(int tx, int ty, int c) { return (float*)tileData(tx, ty) + (size_t)c * tile * tile; }
+    uint8_t* mask(int tx, int ty) { return tileData(tx, ty) + 3 * sizeof(float) * tile * tile; }
+
+    // Writes the tiles [tx0, tx1) of rows [ty0, ty1) back to disk and unmaps them; they are
+    // mapped again if touched later
+    void release(int tx0, int ty0, int tx1, int ty1) {
+        if (windows.empty()) return;
+        for (int ty = std::max(ty0, 0); ty < std::min(ty1, tilesY); ++ty)
+            for (int tx = std::max(tx0, 0); tx < std::min(tx1, tilesX); ++tx) {
+                uint8_t*& window = windows[(size_t)ty * tilesX + tx];
+                if (!window) continue;
+                unmapWindow(window, tileOffset(tx, ty), tileBytes());
+                window = nullptr;
+            }
+    }
+
+private:
+    static const uint64_t headerBytes = 64;
+    uint64_t size = 0;                  // of the file
+    std::vector<uint8_t*> windows;      // mapped tiles, row-major, nullptr = not mapped
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+
+    uint64_t tileBytes() const { return (uint64_t)tile * tile * (3 * sizeof(float) + 1); }
+    uint64_t tileOffset(int tx, int ty) const { return headerBytes + tileBytes() * ((uint64_t)ty * tilesX + tx); }
+
+    uint8_t* tileData(int tx, int ty) {
+        uint8_t*& window = windows[(size_t)ty * tilesX + tx];
+        if (!window) window = mapWindow(tileOffset(tx, ty), tileBytes());
+        if (!window) {
+            // Out of address space or a failing disk; the caller has nowhere to go on from here
+            std::cerr << "Could not map tile (" << tx << ", " << ty << ") of the tile store" << std::endl;
+            std::exit(1);
+        }
+        return window;
+    }
+
+    // Windows start on the mapping granularity, so each one begins up to a granule before its data
+    static uint64_t granularity() {
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwAllocationGranularity;
+#else
+        return (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+    }
+
+    uint8_t* mapWindow(uint64_t offset, uint64_t bytes) {
+        uint64_t start = offset / granularity() * granularity();
+        uint64_t length = offset - start + bytes;
+        if (length > SIZE_MAX) return nullptr;
+#ifdef _WIN32
+        if (!mapping) {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, nullptr);
+            if (!mapping) return nullptr;
         }
+        uint8_t* base = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, (DWORD)(start >> 32), (DWORD)start,
+                                                (SIZE_T)length);
+        if (!base) return nullptr;
+#else
+        void* p = mmap(nullptr, (size_t)length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t)start);
+        if (p == MAP_FAILED) return nullptr;
+        uint8_t* base = (uint8_t*)p;
+#endif
+        return base + (offset - start);
+    }
+
+    void unmapWindow(uint8_t* window, uint64_t offset, uint64_t bytes) {
+        uint64_t start = offset / granularity() * granularity();
+        uint8_t* base = window - (offset - start);
+        size_t length = (size_t)(offset - start + bytes);
+#ifdef _WIN32
+        FlushViewOfFile(base, length);
+        UnmapViewOfFile(base);
+#else
+        msync(base, length, MS_ASYNC);
+        munmap(base, length);
+#endif
+    }
+
+    bool openFile(const std::string& path, bool create) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                           create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER length;
+        if (!GetFileSizeEx(file, &length)) return false;
+        size = (uint64_t)length.QuadPart;
+#else
+        fd = ::open(path.c_str(), create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0644);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) return false;
+        size = (uint64_t)st.st_size;
+#endif
+        return true;
+    }
+
+    bool resize(uint64_t bytes) {
+#ifdef _WIN32
+        LARGE_INTEGER length;
+        length.QuadPart = (LONGLONG)bytes;
+        if (!SetFilePointerEx(file, length, nullptr, FILE_BEGIN) || !SetEndOfFile(file)) return false;
+#else
+        if (bytes > (uint64_t)std::numeric_limits<off_t>::max() || ftruncate(fd, (off_t)bytes) != 0) return false;
+#endif
+        size = bytes;
+        return true;
     }
-    virtual void toPixels(void* pixels, int pitch)=0;
 };
 
-class FloatImage : public Image {
+// Binary PPM (P6) or PGM (P5) with 8-bit samples, read a row at a time, so that tile stores
+// can be made from images larger than memory
+class NetpbmReader {
 public:
-    FloatImage() : Image() {}
+    int w = 0, h = 0;
 
-    virtual void fromSurface(SDL_Surface* surf) {
-        this->init(surf->w, surf->h);
-        uint32_t* pixels = (uint32_t*)surf->pixels;
-        
-        for (int i = 0; i < this->w * this->h; ++i) {
-            uint32_t p = pixels[i];
-            
-            uint8_t r = (p >> 16) & 0xFF;
-            uint8_t g = (p >> 8) & 0xFF;
-            uint8_t b = (p >> 0)  & 0xFF;
+    bool open(const std::string& path) {
+        in.open(path, std::ios::binary);
+        std::string magic;
+        int maxval = 0;
+        if (!(in >> magic) || (magic != "P5" && magic != "P6")) return false;
+        channels = magic == "P6" ? 3 : 1;
+        if (!field(w) || !field(h) || !field(maxval) || w <= 0 || h <= 0 || maxval != 255) return false;
+        in.get();    // the single whitespace before the samples
+        samples.resize((size_t)w * channels);
+        return true;
+    }
 
-            this->r[i] = (double)r;
-            this->g[i] = (double)g;
-            this->b[i] = (double)b;
-            this->mask[i] = false;
+    // Next row as RGBA32 pixels, in the memory order loadSurface gives them
+    bool read(uint32_t* row) {
+        if (!in.read((char*)samples.data(), samples.size())) return false;
+        int g = channels > 1 ? 1 : 0, b = channels > 1 ? 2 : 0;
+        for (int x = 0; x < w; ++x) {
+            const uint8_t* s = &samples[(size_t)x * channels];
+            uint8_t rgba[4] = {s[0], s[g], s[b], 255};
+            std::memcpy(&row[x], rgba, 4);
         }
+        return true;
     }
 
-    virtual void toPixels(void* pixels, int pitch) {
-        uint8_t* bytePixels = (uint8_t*)pixels;
-        for (int y = 0; y < this->h; ++y) {
-            uint32_t* row = (uint32_t*)(bytePixels + y * pitch);
-            for (int x = 0; x < this->w; ++x) {
-                int idx = y * this->w + x;
-                
-                uint8_t r = (uint8_t)std::clamp(this->r[idx], 0.0, 255.0);
-                uint8_t g = (uint8_t)std::clamp(this->g[idx], 0.0, 255.0);
-                uint8_t b = (uint8_t)std::clamp(this->b[idx], 0.0, 255.0);
-                
-                row[x] = (255 << 24) | (r << 16) | (g << 8) | b;
-            }
+private:
+    std::ifstream in;
+    std::vector<uint8_t> samples;
+    int channels = 3;
+
+    // Skips whitespace and # comments, then reads a number
+    bool field(int& value) {
+        in >> std::ws;
+        while (in.peek() == '#') {
+            in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            in >> std::ws;
         }
+        return (bool)(in >> value);
     }
 };
 
-class HSLuvImage : public Image {
+// The rows of an input image, top to bottom: streamed from binary PPM/PGM, or from the whole
+// image that SDL_image decodes for every other format
+class ImageRows {
 public:
-    HSLuvImage() : Image() {}
+    int w = 0, h = 0;
 
-    virtual void fromSurface(SDL_Surface* surf) {
-        this->init(surf->w, surf->h);
+    ~ImageRows() {
+        if (surface) SDL_DestroySurface(surface);
+    }
 
-        uint32_t* pixels = (uint32_t*)surf->pixels;
-        
-        for (int i = 0; i < this->w * this->h; ++i) {
-            uint32_t p = pixels[i];
-            
-            uint8_t r = (p >> 16) & 0xFF;
-            uint8_t g = (p >> 8) & 0xFF;
-            uint8_t b = (p >> 0)  & 0xFF;
+    bool open(const std::string& path) {
+        if (netpbm.open(path)) {
+            w = netpbm.w;
+            h = netpbm.h;
+            row.resize(w);
+            return true;
+        }
+        surface = loadSurface(path);
+        if (!surface) return false;
+        w = surface->w;
+        h = surface->h;
+        return true;
+    }
+
+    // The next row, or nullptr if the file ends early
+    const uint32_t* next() {
+        if (surface) return (const uint32_t*)((const uint8_t*)surface->pixels + (size_t)y++ * surface->pitch);
+        return netpbm.read(row.data()) ? row.data() : nullptr;
+    }
+
+private:
+    NetpbmReader netpbm;
+    SDL_Surface* surface = nullptr;
+    std::vector<uint32_t> row;
+    int y = 0;
+};
 
-            rgb2hsluv(r / 255.0, g / 255.0, b / 255.0, &this->r[i], &this->g[i], &this->b[i]);
+// Copies an image and its mask (black = masked, as in loadMask) into a new tile store. The
+// decoded 8-bit pixels go into the tiles a row at a time and each band of tiles is written out
+// once complete. Binary PPM/PGM inputs are streamed, so only a row of them is ever in memory;
+// other formats are decoded whole, one file at a time. Masked pixels are left as they are;
+// runTiled fills every hole before solving it.
+bool makeTiles(const std::string& imagePath, const std::string& maskPath, const std::string& storePath, int tile) {
+    TileStore store;
+    {
+        ImageRows image;
+        if (!image.open(imagePath)) {
+            std::cerr << "Could not load '" << imagePath << "'" << std::endl;
+            return false;
+        }
+        if (!store.create(storePath, image.w, image.h, tile)) {
+            std::cerr << "Could not create tile store '" << storePath << "'" << std::endl;
+            return false;
+        }
+        for (int y = 0; y < store.h; ++y) {
+            const uint32_t* row = image.next();
+            if (!row) {
+                std::cerr << "'" << imagePath << "' ends at row " << y << std::endl;
+                return false;
+            }
+            for (int x = 0; x < store.w; ++x) {
+                int tx = x / tile, ty = y / tile;
+                int i = (y % tile) * tile + x % tile;
+                Sample c[3];
+                RgbSpace::forward(row[x], c);
+                for (int k = 0; k < 3; ++k) store.plane(tx, ty, k)[i] = c[k];
+            }
+            if ((y + 1) % tile == 0 || y + 1 == store.h) store.release(0, y / tile, store.tilesX, y / tile + 1);
+        }
+    }
 
-            this->mask[i] = false;
+    ImageRows mask;
+    if (!mask.open(maskPath) || mask.w != store.w || mask.h != store.h) {
+        std::cerr << "Could not load '" << maskPath << "' at the size of the image" << std::endl;
+        return false;
+    }
+    for (int y = 0; y < store.h; ++y) {
+        const uint32_t* row = mask.next();
+        if (!row) {
+            std::cerr << "'" << maskPath << "' ends at row " << y << std::endl;
+            return false;
+        }
+        for (int x = 0; x < store.w; ++x) {
+            Sample c[3];
+            RgbSpace::forward(row[x], c);
+            store.mask(x / tile, y / tile)[(y % tile) * tile + x % tile] = c[0] == 0 && c[1] == 0 && c[2] == 0;
         }
+        if ((y + 1) % tile == 0 || y + 1 == store.h) store.release(0, y / tile, store.tilesX, y / tile + 1);
     }
+    return true;
+}
 
-    virtual void toPixels(void* pixels, int pitch) {
-        uint8_t* bytePixels = (uint8_t*)pixels;
-        for (int y = 0; y < this->h; ++y) {
-            uint32_t* row = (uint32_t*)(bytePixels + y * pitch);
-            for (int x = 0; x < this->w; ++x) {
-                int idx = y * this->w + x;
-                
-                double rd, gd, bd;
-                hsluv2rgb(this->r[idx], this->g[idx], this->b[idx], &rd, &gd, &bd);
+// Writes a tile store out as an image file, a row at a time: a .ppm output is streamed, so only
+// a row of it is in memory. Other formats go through the 8-bit surface the encoder takes, which
+// holds the whole image and is refused when the process cannot address it.
+bool untile(const std::string& storePath, const std::string& outputPath) {
+    TileStore store;
+    if (!store.open(storePath)) {
+        std::cerr << "Could not open tile store '" << storePath << "'" << std::endl;
+        return false;
+    }
+    auto convert = [&](int y, uint32_t* row) {
+        for (int x = 0; x < store.w; ++x) {
+            int tx = x / store.tile, ty = y / store.tile;
+            int i = (y % store.tile) * store.tile + x % store.tile;
+            row[x] = RgbSpace::exact(store.plane(tx, ty, 0)[i], store.plane(tx, ty, 1)[i], store.plane(tx, ty, 2)[i]);
+        }
+        if ((y + 1) % store.tile == 0 || y + 1 == store.h)
+            store.release(0, y / store.tile, store.tilesX, y / store.tile + 1);
+    };
 
-                uint8_t r = (uint8_t)(rd * 255);
-                uint8_t g = (uint8_t)(gd * 255);
-                uint8_t b = (uint8_t)(bd * 255);
-                
-                row[x] = (255 << 24) | (r << 16) | (g << 8) | b;
-            }
+    std::string extension = outputPath.substr(std::min(outputPath.rfind('.'), outputPath.size()));
+    if (extension == ".ppm" || extension == ".PPM") {
+        std::ofstream out(outputPath, std::ios::binary);
+        out << "P6\n" << store.w << " " << store.h << "\n255\n";
+        std::vector<uint32_t> row(store.w);
+        std::vector<uint8_t> samples(3 * (size_t)store.w);
+        for (int y = 0; y < store.h && out; ++y) {
+            convert(y, row.data());
+            for (int x = 0; x < store.w; ++x) std::memcpy(&samples[3 * (size_t)x], &row[x], 3);
+            out.write((const char*)samples.data(), samples.size());
         }
+        return (bool)out;
     }
-};
 
-class YcbcrImage : public Image {
-public:
-    YcbcrImage() : Image() {}
+    if ((uint64_t)store.w * store.h * 4 > (uint64_t)std::numeric_limits<int>::max()) {
+        std::cerr << store.w << "x" << store.h << " is too large to encode in memory; write a .ppm instead" << std::endl;
+        return false;
+    }
+    SDL_Surface* surface = SDL_CreateSurface(store.w, store.h, SDL_PIXELFORMAT_RGBA32);
+    if (!surface) {
+        std::cerr << "Could not allocate a " << store.w << "x" << store.h << " surface" << std::endl;
+        return false;
+    }
+    for (int y = 0; y < store.h; ++y) convert(y, (uint32_t*)((uint8_t*)surface->pixels + (size_t)y * surface->pitch));
+    bool saved = IMG_SavePNG(surface, outputPath.c_str());
+    SDL_DestroySurface(surface);
+    return saved;
+}
 
-    virtual void fromSurface(SDL_Surface* surf) {
-        this->init(surf->w, surf->h);
+// Out-of-core solve of a tile store in place. Tiles holding masked pixels are grouped into
+// 8-connected components, and each component is solved on its own in an in-memory image
+// covering its bounding box plus a halo as wide as the stencil. Only the component's tiles and
+// the strips around them that the method reads are paged in; the rest of the box stays zero
+// and is never looked at, so a long diagonal stroke does not read the tiles it skips. Masked
+// pixels of other components that fall inside the box are held fixed; they are at least a
+// tile away, so they do not couple. Memory is bounded by the largest hole, not the canvas.
+int runTiled(const std::string& storePath, SolveMethod method, bool biharmonic) {
+    TileStore store;
+    if (!store.open(storePath)) {
+        std::cerr << "Could not open tile store '" << storePath << "'" << std::endl;
+        return 1;
+    }
+    int tile = store.tile;
+    std::vector<int> component(store.tilesX * store.tilesY, -1);
+    std::vector<uint8_t> masked(store.tilesX * store.tilesY, 0);
+    for (int ty = 0; ty < store.tilesY; ++ty)
+        for (int tx = 0; tx < store.tilesX; ++tx) {
+            const uint8_t* m = store.mask(tx, ty);
+            masked[ty * store.tilesX + tx] = std::any_of(m, m + tile * tile, [](uint8_t v) { return v != 0; });
+            store.release(tx, ty, tx + 1, ty + 1);
+        }
 
-        uint32_t* pixels = (uint32_t*)surf->pixels;
-        
-        for (int i = 0; i < this->w * this->h; ++i) {
-            uint32_t p = pixels[i];
-            
-            uint8_t r = (p >> 16) & 0xFF;
-            uint8_t g = (p >> 8) & 0xFF;
-            uint8_t b = (p >> 0)  & 0xFF;
+    // How far around its unknowns a method reads: the stencil, or fast marching's radius plus
+    // the gradient it takes there. PatchMatch looks for source patches all over the box.
+    int halo = biharmonic ? 2 : 1;
+    int reach = method == METHOD_MARCH ? 6 : halo;
+    int components = 0;
+    long long unknowns = 0;
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int seed = 0; seed < store.tilesX * store.tilesY; ++seed) {
+        if (!masked[seed] || component[seed] >= 0) continue;
+        // Flood-fill the component and find its bounding box in tiles
+        int tx0 = store.tilesX, ty0 = store.tilesY, tx1 = 0, ty1 = 0;
+        std::vector<int> stack = {seed}, tiles;
+        component[seed] = components;
+        while (!stack.empty()) {
+            int t = stack.back();
+            stack.pop_back();
+            tiles.push_back(t);
+            int tx = t % store.tilesX, ty = t / store.tilesX;
+            tx0 = std::min(tx0, tx);
+            ty0 = std::min(ty0, ty);
+            tx1 = std::max(tx1, tx + 1);
+            ty1 = std::max(ty1, ty + 1);
+            for (int dy = -1; dy <= 1; ++dy)
+                for (int dx = -1; dx <= 1; ++dx) {
+                    int nx = tx + dx, ny = ty + dy;
+                    if (nx < 0 || ny < 0 || nx >= store.tilesX || ny >= store.tilesY) continue;
+                    int n = ny * store.tilesX + nx;
+                    if (masked[n] && component[n] < 0) {
+                        component[n] = components;
+                        stack.push_back(n);
+                    }
+                }
+        }
 
-            this->r[i] = 0.299 * r + 0.587 * g + 0.114 * b;
-            this->g[i] = 0.564 * (b - this->r[i]);
-            this->b[i] = 0.713 * (r - this->r[i]);
+        int x0 = std::max(tx0 * tile - reach, 0), y0 = std::max(ty0 * tile - reach, 0);
+        int x1 = std::min(tx1 * tile + reach, store.w), y1 = std::min(ty1 * tile + reach, store.h);
+        FloatImage region;
+        region.init(x1 - x0, y1 - y0);
+        // Copies [ax0, ax1) x [ay0, ay1) of the box in; the mask only where it is this component's
+        auto pageIn = [&](int ax0, int ay0, int ax1, int ay1) {
+            for (int y = std::max(ay0, y0); y < std::min(ay1, y1); ++y)
+                for (int x = std::max(ax0, x0); x < std::min(ax1, x1); ++x) {
+                    int tx = x / tile, ty = y / tile;
+                    int i = (y % tile) * tile + x % tile;
+                    int idx = (y - y0) * region.w + (x - x0);
+                    region.r[idx] = store.plane(tx, ty, 0)[i];
+                    region.g[idx] = store.plane(tx, ty, 1)[i];
+                    region.b[idx] = store.plane(tx, ty, 2)[i];
+                    region.mask[idx] = component[ty * store.tilesX + tx] == components && store.mask(tx, ty)[i];
+                }
+        };
+        if (method == METHOD_PATCH) {
+            pageIn(x0, y0, x1, y1);
+        } else {
+            for (int t : tiles) {
+                int tx = t % store.tilesX, ty = t / store.tilesX;
+                pageIn(tx * tile - reach, ty * tile - reach, (tx + 1) * tile + reach, (ty + 1) * tile + reach);
+            }
+        }
+        region.updateSpans();
+        fillMask(region);
+        double change;
+        solveImage(region, method, biharmonic, change);
 
-            this->mask[i] = false;
+        for (int t : tiles) {
+            int tx = t % store.tilesX, ty = t / store.tilesX;
+            for (int y = ty * tile; y < std::min((ty + 1) * tile, store.h); ++y)
+                for (int x = tx * tile; x < std::min((tx + 1) * tile, store.w); ++x) {
+                    int idx = (y - y0) * region.w + (x - x0);
+                    if (!region.mask[idx]) continue;
+                    int i = (y % tile) * tile + x % tile;
+                    store.plane(tx, ty, 0)[i] = region.r[idx];
+                    store.plane(tx, ty, 1)[i] = region.g[idx];
+                    store.plane(tx, ty, 2)[i] = region.b[idx];
+                    ++unknowns;
+                }
         }
+        store.release(std::max(x0 / tile, 0), y0 / tile, (x1 + tile - 1) / tile, (y1 + tile - 1) / tile);
+        ++components;
+    }
+
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    std::cout << storePath << ": " << store.w << "x" << store.h << ", " << components << " holes, " << unknowns
+              << " masked pixels in " << seconds << " s" << std::endl;
+    return 0;
+}
+
+// Benchmark suite: every solver on every synthetic mask over a smooth image whose values
+// inside the hole are known. One CSV row per run, so the output of two builds can be diffed.
+
+// Peak resident memory in KiB since the last reset. Linux can reset the high-water mark;
+// elsewhere it is the peak of the whole process so far.
+long peakMemoryKB(bool reset) {
+#ifdef _WIN32
+    (void)reset;
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return -1;
+    return (long)(counters.PeakWorkingSetSize / 1024);
+#else
+    if (reset) {
+        std::ofstream clear("/proc/self/clear_refs");
+        if (clear) clear << "5";
     }
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+        if (line.compare(0, 6, "VmHWM:") == 0) return std::stol(line.substr(6));
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#endif
+}
 
-    virtual void toPixels(void* pixels, int pitch) {
-        uint8_t* bytePixels = (uint8_t*)pixels;
-        for (int y = 0; y < this->h; ++y) {
-            uint32_t* row = (uint32_t*)(bytePixels + y * pitch);
-            for (int x = 0; x < this->w; ++x) {
-                int idx = y * this->w + x;
-                
-                double rd, gd, bd;
-                rd = this->b[idx] / 0.713 + this->r[idx];
-                bd = this->g[idx] / 0.564 + this->r[idx];
-                gd = (this->r[idx] - 0.299 * rd - 0.114 * bd) / 0.587;
+// Smooth ground truth: a slow wave, a quadratic and a ramp, all inside 0..255
+void benchImage(FloatImage& img, int w, int h) {
+    img.init(w, h);
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x) {
+            double u = (double)x / w, v = (double)y / h;
+            int idx = y * w + x;
+            img.r[idx] = (Sample)(128.0 + 100.0 * std::sin(5.0 * u) * std::cos(3.0 * v));
+            img.g[idx] = (Sample)(40.0 + 170.0 * (u - 0.5) * (u - 0.5) * 4.0 * v);
+            img.b[idx] = (Sample)(30.0 + 200.0 * (0.7 * u + 0.3 * v));
+        }
+}
 
-                uint8_t r = (uint8_t)(std::clamp(rd, 0.0, 255.0));
-                uint8_t g = (uint8_t)(std::clamp(gd, 0.0, 255.0));
-                uint8_t b = (uint8_t)(std::clamp(bd, 0.0, 255.0));
-                
-                row[x] = (255 << 24) | (r << 16) | (g << 8) | b;
+// Masks as a user would draw them, all made of brush stamps and seeded for repeatable runs.
+// They keep clear of the image edge, which the sweeps treat as fixed.
+template <class T>
+void benchMask(Image<T>& img, const std::string& shape) {
+    int w = img.w, h = img.h, side = std::min(w, h), edge = side / 16;
+    unsigned state = 12345;
+    auto random = [&](int range) {
+        state = state * 1664525u + 1013904223u;
+        return (int)((state >> 8) % (unsigned)range);
+    };
+    if (shape == "disc") {
+        applyBrush(img, w / 2, h / 2, true, side / 10);
+    } else if (shape == "strokes") {
+        for (int stroke = 0; stroke < 6; ++stroke) {
+            double x = edge + random(w - 2 * edge), y = edge + random(h - 2 * edge), angle = random(628) / 100.0;
+            for (int k = 0; k < side; k += 2) {
+                applyBrush(img, (int)x, (int)y, true, std::max(2, side / 64));
+                angle += (random(100) - 50) / 400.0;
+                x = std::clamp(x + 2.0 * std::cos(angle), (double)edge, (double)(w - edge));
+                y = std::clamp(y + 2.0 * std::sin(angle), (double)edge, (double)(h - edge));
             }
         }
+    } else if (shape == "scatter") {
+        for (int k = 0; k < w * h / 400; ++k) applyBrush(img, edge + random(w - 2 * edge), edge + random(h - 2 * edge), true, 2);
+    } else if (shape == "huge") {
+        applyBrush(img, w / 2, h / 2, true, side * 3 / 8);
     }
-};
+}
 
-// Helper: Load image from disk and convert to FloatImage
-bool loadImage(const std::string& path, Image& img) {
-    SDL_Surface* loadedSurface = IMG_Load(path.c_str());
-    if (!loadedSurface) {
-        std::cerr << "IMG_Load failed: " << SDL_GetError() << std::endl;
-        return false;
+int runBenchmark(const std::string& outputPath, int size) {
+    struct Config { const char* name; SolveMethod method; bool biharmonic; };
+    static const Config configs[] = {
+        {"laplace", METHOD_SOR, false},       {"biharmonic", METHOD_SOR, true},
+        {"multigrid", METHOD_MULTIGRID, false}, {"multigrid-biharmonic", METHOD_MULTIGRID, true},
+        {"cg", METHOD_CG, false},             {"cg-biharmonic", METHOD_CG, true},
+        {"fill", METHOD_FILL, false},         {"march", METHOD_MARCH, false},
+        {"patch", METHOD_PATCH, false}};
+    static const char* shapes[] = {"disc", "strokes", "scatter", "huge"};
+
+    std::ofstream file;
+    if (outputPath != "-") {
+        file.open(outputPath);
+        if (!file) {
+            std::cerr << "Could not write '" << outputPath << "'" << std::endl;
+            return 1;
+        }
     }
+    std::ostream& out = outputPath == "-" ? std::cout : file;
+    out << "mask,solver,width,height,unknowns,sweeps,seconds,ns_per_pixel_sweep,final_residual,tolerance,"
+           "peak_kb,rms_error,max_error\n";
 
-    SDL_Surface* formattedSurf = SDL_ConvertSurface(loadedSurface, SDL_PIXELFORMAT_RGBA32);
-    SDL_DestroySurface(loadedSurface);
+    FloatImage truth;
+    benchImage(truth, size, size);
+    for (const char* shape : shapes)
+        for (const Config& config : configs) {
+            FloatImage image = truth;
+            benchMask(image, shape);
+            long unknowns = 0;
+            for (int y = 0; y < image.h; ++y)
+                for (const MaskSpan& s : image.spans[y]) unknowns += s.x1 - s.x0;
 
-    if (!formattedSurf) return false;
+            peakMemoryKB(true);
+            Uint64 start = SDL_GetPerformanceCounter();
+            fillMask(image);
+            double change;
+            long long sweeps = solveImage(image, config.method, config.biharmonic, change);
+            double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+            long peak = peakMemoryKB(false);
 
-    img.fromSurface(formattedSurf);
+            double squares = 0.0, worst = 0.0;
+            const Sample* planes[3] = {image.r.data(), image.g.data(), image.b.data()};
+            const Sample* exact[3] = {truth.r.data(), truth.g.data(), truth.b.data()};
+            for (int i = 0; i < image.w * image.h; ++i)
+                if (image.mask[i])
+                    for (int c = 0; c < 3; ++c) {
+                        double e = std::abs((double)planes[c][i] - exact[c][i]);
+                        squares += e * e;
+                        worst = std::max(worst, e);
+                    }
+            double rms = unknowns ? std::sqrt(squares / (3.0 * unknowns)) : 0.0;
+            double ns = 1e9 * seconds / ((double)unknowns * std::max(sweeps, 1LL));
 
-    SDL_DestroySurface(formattedSurf);
-    return true;
+            // Fill, fast marching and PatchMatch run a fixed number of passes; the change of their last
+            // pass is not a residual and no tolerance applies, so both columns stay empty
+            std::ostringstream stop;
+            if (config.method == METHOD_CG) stop << change << "," << ConjugateGradient().tolerance;
+            else if (config.method == METHOD_SOR || config.method == METHOD_MULTIGRID) stop << change << "," << SOLVE_TOLERANCE;
+            else stop << ",";
+            out << shape << "," << config.name << "," << image.w << "," << image.h << "," << unknowns << ","
+                << sweeps << "," << seconds << "," << ns << "," << stop.str() << "," << peak << "," << rms << ","
+                << worst << std::endl;
+            if (outputPath != "-")
+                std::cout << shape << " " << config.name << ": " << sweeps << sweepName(config.method) << ", "
+                          << seconds << " s, rms error " << rms << std::endl;
+        }
+    return 0;
 }
 
-void saveImage(Image& img, const std::string& path) {
-    SDL_Surface* surf = SDL_CreateSurface(img.w, img.h, SDL_PIXELFORMAT_RGBA32);
-    img.toSurface(surf);
-    IMG_SavePNG(surf, path.c_str());
-    SDL_DestroySurface(surf);
+// Checks HSLuvDisplayTable against hsluv.c: every colour of the 8-bit cube after rgb2hsluv, then
+// seeded random points over the whole input range (hue 0..360, saturation and lightness 0..100)
+// as the solvers produce them. Prints the largest difference in any channel and fails if the
+// cube is not matched exactly or anything else is off by more than one level.
+int runHSLuvCheck() {
+    auto distance = [](uint32_t a, uint32_t b) {
+        int worst = 0;
+        for (int shift = 0; shift < 24; shift += 8)
+            worst = std::max(worst, std::abs((int)(a >> shift & 0xFF) - (int)(b >> shift & 0xFF)));
+        return worst;
+    };
+    const HSLuvDisplayTable& table = hsluvDisplayTable();
+    long long cubeMisses = 0;
+    int cubeWorst = 0;
+    for (uint32_t rgb = 0; rgb < (1u << 24); ++rgb) {
+        double c[3];
+        HSLuvSpace::forward(rgb, c);
+        int d = distance(table.pixel(c[0], c[1], c[2]), HSLuvSpace::exact(c[0], c[1], c[2]));
+        cubeMisses += d > 0;
+        cubeWorst = std::max(cubeWorst, d);
+    }
+
+    const long long samples = 1 << 24;
+    unsigned state = 12345;
+    auto uniform = [&](double range) {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) * range / (1 << 24);
+    };
+    long long rangeMisses = 0;
+    int rangeWorst = 0;
+    for (long long k = 0; k < samples; ++k) {
+        double h = uniform(360.0), s = uniform(100.0), l = uniform(100.0);
+        int d = distance(table.pixel(h, s, l), HSLuvSpace::exact(h, s, l));
+        rangeMisses += d > 0;
+        rangeWorst = std::max(rangeWorst, d);
+    }
+
+    std::cout << "8-bit cube: " << cubeMisses << " of " << (1 << 24) << " colours differ, by at most " << cubeWorst
+              << "\nInput range: " << rangeMisses << " of " << samples << " samples differ, by at most " << rangeWorst
+              << std::endl;
+    return cubeMisses == 0 && rangeWorst <= 1 ? 0 : 1;
 }
 
-void fillMask(Image& img) {
-    int w = img.w;
-    int h = img.h;
+// Undo and redo for brush strokes, kept as tile snapshots. Before a stroke first touches a
+// 64x64 tile, the tile's planes and mask are copied; undoing puts them back and redoing puts
+// back a copy taken at undo time. Snapshots are immutable and shared: a tile that has not
+// changed since its last snapshot reuses it, so history grows with the edited area, not with
+// the image. Solver output in holes away from a stroke is not part of the history.
+template <class T>
+class UndoHistory {
+public:
+    static const int TILE = 64;
+    size_t limitBytes = 256u << 20;    // oldest strokes are dropped beyond this
 
-    for (int y = 1; y < h - 1; ++y) {
-        for (int x = 1; x < w - 1; ++x) {
-            int idx = y * w + x;
-            if (img.mask[idx]) {
-                int y_up = y;
-                while (y_up > 0 && img.mask[y_up * w + x]) --y_up;
-                int y_down = y;
-                while (y_down < h - 1 && img.mask[y_down * w + x]) ++y_down;
-                int x_left = x;
-                while (x_left > 0 && img.mask[y * w + x_left]) --x_left;
-                int x_right = x;
-                while (x_right < w - 1 && img.mask[y * w + x_right]) ++x_right;
-                int n_up    = (y_up) * w + x;
-                int n_down  = (y_down) * w + x;
-                int n_left  = y * w + (x_left);
-                int n_right = y * w + (x_right);
+    bool canUndo() const { return !undoStack.empty(); }
+    bool canRedo() const { return !redoStack.empty(); }
 
-                double r_up = 1. / pow(y - y_up, 2);
-                double r_down = 1. / pow(y_down - y, 2);
-                double r_left = 1. / pow(x - x_left, 2);
-                double r_right = 1. / pow(x_right - x, 2);
-                double r_sum = r_up + r_down + r_left + r_right;
+    // Forgets everything, for a reloaded image
+    void clear() {
+        undoStack.clear();
+        redoStack.clear();
+        pending = Edit();
+        latest.clear();
+        tilesX = 0;
+    }
 
-                double k_up = r_up / r_sum;
-                double k_down = r_down / r_sum;
-                double k_left = r_left / r_sum;
-                double k_right = r_right / r_sum;
+    void beginStroke() {
+        endStroke();
+    }
 
-                img.r[idx] = img.r[n_up] * k_up + img.r[n_down] * k_down + img.r[n_left] * k_left + img.r[n_right] * k_right;
-                img.g[idx] = img.g[n_up] * k_up + img.g[n_down] * k_down + img.g[n_left] * k_left + img.g[n_right] * k_right;
-                img.b[idx] = img.b[n_up] * k_up + img.b[n_down] * k_down + img.b[n_left] * k_left + img.b[n_right] * k_right;
+    // Call before changing [x0, x1) x [y0, y1): saves the tiles this stroke has not touched yet
+    void touch(const Image<T>& img, int x0, int y0, int x1, int y1) {
+        resize(img);
+        for (int ty = std::max(y0, 0) / TILE; ty <= (std::min(y1, img.h) - 1) / TILE; ++ty)
+            for (int tx = std::max(x0, 0) / TILE; tx <= (std::min(x1, img.w) - 1) / TILE; ++tx) {
+                int tile = ty * tilesX + tx;
+                if (std::find(pending.tiles.begin(), pending.tiles.end(), tile) != pending.tiles.end()) continue;
+                pending.tiles.push_back(tile);
+                pending.before.push_back(snapshot(img, tile));
             }
+    }
+
+    void endStroke() {
+        if (pending.tiles.empty()) return;
+        undoStack.push_back(std::move(pending));
+        pending = Edit();
+        redoStack.clear();
+        trim();
+    }
+
+    // Both return the number of tiles restored, 0 if there was nothing to do
+    int undo(Image<T>& img) {
+        endStroke();
+        return move(img, undoStack, redoStack);
+    }
+
+    int redo(Image<T>& img) {
+        endStroke();
+        return move(img, redoStack, undoStack);
+    }
+
+    // Bytes held by distinct snapshots
+    size_t bytes() const {
+        std::vector<const Tile*> tiles;
+        for (const std::vector<Edit>* stack : {&undoStack, &redoStack})
+            for (const Edit& edit : *stack)
+                for (const TileRef& tile : edit.before) tiles.push_back(tile.get());
+        std::sort(tiles.begin(), tiles.end());
+        tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
+        size_t total = 0;
+        for (const Tile* tile : tiles) total += tile->size();
+        return total;
+    }
+
+private:
+    struct Tile {
+        std::vector<T> r, g, b;
+        std::vector<uint8_t> mask;
+        size_t size() const { return 3 * r.size() * sizeof(T) + mask.size(); }
+        bool operator==(const Tile& o) const { return r == o.r && g == o.g && b == o.b && mask == o.mask; }
+    };
+    typedef std::shared_ptr<const Tile> TileRef;
+
+    // before holds what undoing restores; on the redo stack it holds what redoing restores
+    struct Edit {
+        std::vector<int> tiles;
+        std::vector<TileRef> before;
+    };
+
+    std::vector<Edit> undoStack, redoStack;
+    Edit pending;
+    std::vector<TileRef> latest;    // newest snapshot of every tile, for sharing
+    int tilesX = 0;
+
+    void resize(const Image<T>& img) {
+        int across = (img.w + TILE - 1) / TILE, down = (img.h + TILE - 1) / TILE;
+        if (tilesX == across && (int)latest.size() == across * down) return;
+        clear();
+        tilesX = across;
+        latest.resize((size_t)across * down);
+    }
+
+    void bounds(const Image<T>& img, int tile, int& x0, int& y0, int& x1, int& y1) const {
+        x0 = tile % tilesX * TILE;
+        y0 = tile / tilesX * TILE;
+        x1 = std::min(x0 + TILE, img.w);
+        y1 = std::min(y0 + TILE, img.h);
+    }
+
+    TileRef snapshot(const Image<T>& img, int tile) {
+        int x0, y0, x1, y1;
+        bounds(img, tile, x0, y0, x1, y1);
+        auto copy = std::make_shared<Tile>();
+        for (int y = y0; y < y1; ++y) {
+            int i = y * img.w;
+            copy->r.insert(copy->r.end(), img.r.begin() + i + x0, img.r.begin() + i + x1);
+            copy->g.insert(copy->g.end(), img.g.begin() + i + x0, img.g.begin() + i + x1);
+            copy->b.insert(copy->b.end(), img.b.begin() + i + x0, img.b.begin() + i + x1);
+            copy->mask.insert(copy->mask.end(), img.mask.begin() + i + x0, img.mask.begin() + i + x1);
         }
+        if (latest[tile] && *latest[tile] == *copy) return latest[tile];
+        latest[tile] = copy;
+        return copy;
     }
-}
 
-// Draw the mask at mouse position
-void applyBrush(Image& img, int mx, int my, bool clear=false) {
-    int r2 = BRUSH_RADIUS * BRUSH_RADIUS;
-
-    for (int y = my - BRUSH_RADIUS; y <= my + BRUSH_RADIUS; ++y) {
-        for (int x = mx - BRUSH_RADIUS; x <= mx + BRUSH_RADIUS; ++x) {
-            if (x >= 0 && x < img.w && y >= 0 && y < img.h) {
-                int dx = x - mx;
-                int dy = y - my;
-                if (dx*dx + dy*dy <= r2) {
-                    int idx = y * img.w + x;
-                    img.mask[idx] = true;
-                    if (clear) {
-                        img.r[idx] = 0.0;
-                        img.g[idx] = 0.0;
-                        img.b[idx] = 0.0;
-                    }
-                }
+    // Restores the newest edit of from and files the current tiles under to
+    int move(Image<T>& img, std::vector<Edit>& from, std::vector<Edit>& to) {
+        if (from.empty()) return 0;
+        Edit edit = std::move(from.back());
+        from.pop_back();
+        Edit reverse;
+        reverse.tiles = edit.tiles;
+        for (size_t k = 0; k < edit.tiles.size(); ++k) {
+            int tile = edit.tiles[k];
+            reverse.before.push_back(snapshot(img, tile));
+            int x0, y0, x1, y1;
+            bounds(img, tile, x0, y0, x1, y1);
+            const Tile& saved = *edit.before[k];
+            int width = x1 - x0;
+            for (int y = y0; y < y1; ++y) {
+                int i = y * img.w + x0, j = (y - y0) * width;
+                std::copy(saved.r.begin() + j, saved.r.begin() + j + width, img.r.begin() + i);
+                std::copy(saved.g.begin() + j, saved.g.begin() + j + width, img.g.begin() + i);
+                std::copy(saved.b.begin() + j, saved.b.begin() + j + width, img.b.begin() + i);
+                std::copy(saved.mask.begin() + j, saved.mask.begin() + j + width, img.mask.begin() + i);
             }
+            latest[tile] = edit.before[k];
+            img.updateSpans(x0, y0, x1, y1);
+            img.markDirty(x0, y0, x1, y1);
         }
+        to.push_back(std::move(reverse));
+        return (int)edit.tiles.size();
     }
-    if (clear && useFill) fillMask(img);
-}
 
-void loadMask(Image& img, Image& mask) {
-    for (int i = 0; i < img.h * img.w; ++i) {
-        if (mask.r[i] == 0 && mask.g[i] == 0 && mask.b[i] == 0) {
-            img.mask[i] = true;
-        }
+    void trim() {
+        while (undoStack.size() > 1 && bytes() > limitBytes) undoStack.erase(undoStack.begin());
     }
-    fillMask(img);
-}
+};
 
-// 1. LAPLACE SOLVER (Membrane)
-// Minimizes 1st Derivative (Gradient). Creates a tight, smooth transition.
-// Stencil: 4 neighbors.
-void solveLaplaceStep(Image& img) {
-    int w = img.w;
-    int h = img.h;
+// Runs the solver on its own thread so the event loop never waits for a sweep. Everything that
+// touches the image (brush stamps, mode switches, reload, save) is posted as a command and runs
+// on the solver thread between sweeps. The solver converts what it changed into a back buffer
+// and hands the changed rectangle over to the render thread through a front buffer.
+template <class T>
+class SolverThread {
+public:
+    std::atomic<bool> solving{false};
+    std::atomic<long long> sweeps{0};    // total sweeps, cycles or fill passes, for the rate display
 
-    for (int y = 1; y < h - 1; ++y) {
-        for (int x = 1; x < w - 1; ++x) {
-            int idx = y * w + x;
-            if (img.mask[idx]) {
-                int n_up    = (y - 1) * w + x;
-                int n_down  = (y + 1) * w + x;
-                int n_left  = y * w + (x - 1);
-                int n_right = y * w + (x + 1);
+    explicit SolverThread(Image<T>& image)
+        : image(image), back(image.w * image.h), front(image.w * image.h), frontDirty{0, 0, 0, 0} {
+        thread = std::thread([this] { run(); });
+    }
 
-                img.r[idx] = (img.r[n_up] + img.r[n_down] + img.r[n_left] + img.r[n_right]) * 0.25f;
-                img.g[idx] = (img.g[n_up] + img.g[n_down] + img.g[n_left] + img.g[n_right]) * 0.25f;
-                img.b[idx] = (img.b[n_up] + img.b[n_down] + img.b[n_left] + img.b[n_right]) * 0.25f;
-            }
+    ~SolverThread() { stop(); }
+
+    void stop() {
+        if (!thread.joinable()) return;
+        post([this] { quit = true; });
+        thread.join();
+    }
+
+    // Queues a command; it runs on the solver thread with the image to itself
+    void post(std::function<void()> command) {
+        {
+            std::lock_guard<std::mutex> lock(commandMutex);
+            commands.push_back(std::move(command));
         }
+        wake.notify_one();
     }
-}
 
-// 2. BIHARMONIC SOLVER (Thin Plate)
-// Minimizes 2nd Derivative (Curvature). Preserves slopes/gradients entering the hole.
-// Stencil: 13 points (Center, 4 Neighbors, 4 Diagonals, 4 Far Neighbors).
-void solveBiharmonicStep(Image& img) {
-    int w = img.w;
-    int h = img.h;
+    // Solver-thread state, only to be touched from posted commands
+    bool biharmonic = false;
+    bool multigridMode = false;
+    double frameBudget = 0.014;           // seconds of solving between command checks and publishes
+    double publishInterval = 1.0 / 60;    // seconds between display conversions while solving
 
-    // We must start from 2 and end at h-2 because the stencil looks 2 pixels out
-    for (int y = 2; y < h - 2; ++y) {
-        for (int x = 2; x < w - 2; ++x) {
-            int idx = y * w + x;
+    // Stats for the title bar
+    std::atomic<int> batchSweeps{0};         // sweeps or cycles in the last batch
+    std::atomic<double> convertSeconds{0};   // last display conversion
+
+    void toggleSolving() {
+        solving = !solving;
+        solveSweeps = 0;
+        solveStart = SDL_GetPerformanceCounter();
+        holes.reset();
+    }
+
+    // Brush stamp; while solving, only the hole it lands in starts sweeping again
+    void brush(int x, int y, int radius) {
+        history.touch(image, x - radius, y - radius, x + radius + 1, y + radius + 1);
+        applyBrush(image, x, y, !solving, radius);
+        holes.invalidate(image, x - radius, y - radius, x + radius + 1, y + radius + 1);
+    }
+
+    // Strokes run from mouse down to mouse up; each one is a step of the history
+    void beginStroke() { history.beginStroke(); }
+    void endStroke() { history.endStroke(); }
+
+    void revert(bool redo) {
+        int tiles = redo ? history.redo(image) : history.undo(image);
+        if (!tiles) return;
+        holes.reset();
+        std::cout << (redo ? "Redo: " : "Undo: ") << tiles << " tiles, history " << history.bytes() / 1024
+                  << " KiB" << std::endl;
+    }
+
+    // After the image was replaced: the holes are labelled afresh on the next round and the
+    // strokes in the history belong to the old image
+    void imageReplaced() {
+        holes.reset();
+        history.clear();
+    }
 
-            if (img.mask[idx]) {
-                // Immediate Neighbors (Weight 8)
-                int n_up    = (y - 1) * w + x;
-                int n_down  = (y + 1) * w + x;
-                int n_left  = y * w + (x - 1);
-                int n_right = y * w + (x + 1);
+    void solveExact() {
+        conjugateGradient.biharmonic = biharmonic;
+        Uint64 start = SDL_GetPerformanceCounter();
+        int iterations = conjugateGradient.solve(image);
+        double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+        std::cout << "Conjugate gradient: " << iterations << " iterations in " << seconds
+                  << " s, relative residual " << conjugateGradient.residual << std::endl;
+        solving = false;
+        image.markMaskDirty();
+    }
+
+    void fillExemplar() {
+        Uint64 start = SDL_GetPerformanceCounter();
+        patchMatch.inpaint(image);
+        double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+        std::cout << "PatchMatch: " << patchMatch.levels << " levels in " << seconds << " s" << std::endl;
+        solving = false;
+    }
+
+    // Render thread: uploads whatever the solver published since the last call
+    void upload(SDL_Texture* texture) {
+        std::lock_guard<std::mutex> lock(frontMutex);
+        if (frontDirty.w <= 0 || frontDirty.h <= 0) return;
+        SDL_UpdateTexture(texture, &frontDirty, &front[frontDirty.y * image.w + frontDirty.x], image.w * 4);
+        frontDirty = {0, 0, 0, 0};
+    }
 
-                // Diagonals (Weight -2)
-                int n_ul = (y - 1) * w + (x - 1);
-                int n_ur = (y - 1) * w + (x + 1);
-                int n_dl = (y + 1) * w + (x - 1);
-                int n_dr = (y + 1) * w + (x + 1);
+private:
+    Image<T>& image;
+    std::thread thread;
+    bool quit = false;
+    std::mutex commandMutex;
+    std::condition_variable wake;
+    std::vector<std::function<void()>> commands;
 
-                // Far Neighbors (Weight -1)
-                int n_up2    = (y - 2) * w + x;
-                int n_down2  = (y + 2) * w + x;
-                int n_left2  = y * w + (x - 2);
-                int n_right2 = y * w + (x + 2);
+    Multigrid<T> multigrid;
+    ConjugateGradient conjugateGradient;
+    PatchMatch patchMatch;
+    HoleScheduler holes;
+    UndoHistory<T> history;
+    long long solveSweeps = 0;
+    Uint64 solveStart = 0;
+    Uint64 lastPublish = 0;
+    double sweepSeconds = 0.0;    // smoothed cost of one hole sweep, 0 until measured
 
-                // Formula: 20*I = 8*Sum(N) - 2*Sum(D) - 1*Sum(F)
-                // Therefore I = ( ... ) / 20.0
-                
-                auto computeChannel = [&](const std::vector<double>& c) -> double {
-                    double sum_n = c[n_up] + c[n_down] + c[n_left] + c[n_right];
-                    double sum_d = c[n_ul] + c[n_ur] + c[n_dl] + c[n_dr];
-                    double sum_f = c[n_up2] + c[n_down2] + c[n_left2] + c[n_right2];
-                    return std::clamp((4.0 * sum_n - 1.0 * sum_d - 0.5 * sum_f) / 10.0, 0.0, 255.0);
-                };
+    std::vector<uint32_t> back, front;
+    std::mutex frontMutex;
+    SDL_Rect frontDirty;
 
-                img.r[idx] = computeChannel(img.r);
-                img.g[idx] = computeChannel(img.g);
-                img.b[idx] = computeChannel(img.b);
+    void run() {
+        while (!quit) {
+            std::vector<std::function<void()>> pending;
+            {
+                std::unique_lock<std::mutex> lock(commandMutex);
+                if (!solving) wake.wait(lock, [this] { return !commands.empty(); });
+                pending.swap(commands);
             }
+            for (auto& command : pending) command();
+            if (solving) step();
+            // Publishing at display rate is plenty; the solver keeps going in between
+            bool idle = !solving;
+            if (idle || SDL_GetPerformanceCounter() - lastPublish > publishInterval * SDL_GetPerformanceFrequency())
+                publish();
         }
     }
-}
 
-int main(int argc, char* argv[]) {
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
-        std::cerr << "SDL init failed: " << SDL_GetError() << std::endl;
-        return 1;
+    // Solves for about frameBudget. Hole rounds are sized from the measured cost of a sweep, which
+    // follows the mask and the stencil; cycles and passes repeat until the budget is spent.
+    void step() {
+        Uint64 frequency = SDL_GetPerformanceFrequency();
+        Uint64 start = SDL_GetPerformanceCounter();
+        double change;
+        int batch = 0;
+        bool done;
+        do {
+            int swept = 1;
+            if (useFill) {
+                change = fillMask(image);
+            } else if (useMarch) {
+                change = fastMarch(image);
+            } else if (multigridMode) {
+                multigrid.biharmonic = biharmonic;
+                change = multigrid.vcycle(image);
+            } else {
+                holes.biharmonic = biharmonic;
+                holes.sweepsPerRound = sweepSeconds > 0.0 ? std::clamp((int)(frameBudget / sweepSeconds), 1, 10000) : 1;
+                Uint64 roundStart = SDL_GetPerformanceCounter();
+                change = holes.round(image);
+                swept = holes.lastSweeps();
+                double seconds = (double)(SDL_GetPerformanceCounter() - roundStart) / frequency;
+                if (swept > 0) sweepSeconds = sweepSeconds > 0.0 ? 0.7 * sweepSeconds + 0.3 * seconds / swept : seconds / swept;
+            }
+            solveSweeps += swept;
+            sweeps += swept;
+            batch += swept;
+            done = useFill || useMarch || multigridMode ? change < SOLVE_TOLERANCE : holes.active() == 0;
+        } while (!done && SDL_GetPerformanceCounter() - start < frameBudget * frequency);
+        batchSweeps = batch;
+        // Solvers only write masked pixels
+        image.markMaskDirty();
+
+        // Stop once the relative residual is below the tolerance; fill and march passes stop
+        // once a pass no longer changes the hole
+        if (done) {
+            solving = false;
+            double seconds = (double)(SDL_GetPerformanceCounter() - solveStart) / SDL_GetPerformanceFrequency();
+            std::cout << "Converged after " << solveSweeps << (multigridMode && !useFill && !useMarch ? " cycles" : " sweeps")
+                      << " in " << seconds << " s, " << (useFill || useMarch ? "max change " : "relative residual ")
+                      << change << std::endl;
+        }
     }
 
-    YcbcrImage image;
+    // Converts the image's dirty rectangle into the back buffer and copies it to the front
+    void publish() {
+        SDL_Rect rect = image.dirty;
+        if (rect.w <= 0 || rect.h <= 0) return;
+        Uint64 start = SDL_GetPerformanceCounter();
+        image.toPixels(&back[rect.y * image.w + rect.x], image.w * 4, rect);
+        image.dirty = {0, 0, 0, 0};
+        lastPublish = SDL_GetPerformanceCounter();
+        convertSeconds = (double)(lastPublish - start) / SDL_GetPerformanceFrequency();
+
+        std::lock_guard<std::mutex> lock(frontMutex);
+        for (int y = rect.y; y < rect.y + rect.h; ++y)
+            std::copy(&back[y * image.w + rect.x], &back[y * image.w + rect.x + rect.w], &front[y * image.w + rect.x]);
+        if (frontDirty.w > 0 && frontDirty.h > 0) {
+            int x0 = std::min(rect.x, frontDirty.x), y0 = std::min(rect.y, frontDirty.y);
+            int x1 = std::max(rect.x + rect.w, frontDirty.x + frontDirty.w);
+            int y1 = std::max(rect.y + rect.h, frontDirty.y + frontDirty.h);
+            rect = {x0, y0, x1 - x0, y1 - y0};
+        }
+        frontDirty = rect;
+    }
+};
+
+// The interactive UI on an image of one colour space
+template <class T>
+int runWindow(Image<T>& image, int argc, char* argv[]) {
     std::string imagePath = "c:/china.jpg"; // Default
     if (argc > 1) imagePath = argv[1];
     
@@ -366,7 +3306,20 @@ int main(int argc, char* argv[]) {
             }
     }
 
+    double budgetMs = 14.0, publishHz = 60.0;
     for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--no-simd") {
+            useSIMD = false;
+        }
+        if (std::string(argv[i]) == "--tol" && i + 1 < argc) {
+            SOLVE_TOLERANCE = std::stod(argv[i + 1]);
+        }
+        if (std::string(argv[i]) == "--budget" && i + 1 < argc) {
+            budgetMs = std::max(1.0, std::stod(argv[i + 1]));
+        }
+        if (std::string(argv[i]) == "--publish-hz" && i + 1 < argc) {
+            publishHz = std::max(1.0, std::stod(argv[i + 1]));
+        }
         if (std::string(argv[i]) == "--mask") {
             if (i + 1 == argc) {
                 loadMask(image, image);
@@ -388,11 +3341,23 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    SDL_SetRenderVSync(renderer, 1);
+
     bool quit = false;
     bool isLeftMouseDown = false;
-    bool isSolving = false;
+    // UI-side copies of the modes, for the title bar and messages; the solver has its own
     bool useBiharmonic = false;
-    bool textureNeedsUpdate = true;
+    bool useMultigrid = false;
+    bool fill = useFill;
+    bool march = useMarch;
+    double omega = SOR_OMEGA;
+    SolverThread solver(image);
+    solver.post([&, budgetMs, publishHz] {
+        solver.frameBudget = budgetMs / 1000.0;
+        solver.publishInterval = 1.0 / publishHz;
+    });
+    long long lastSweeps = 0;
+    Uint64 lastTitle = SDL_GetPerformanceCounter();
 
     SDL_Event e;
 
@@ -400,8 +3365,18 @@ int main(int argc, char* argv[]) {
               << "  [Left Mouse] Draw Mask\n" 
               << "  [Space]      Toggle Solving\n" 
               << "  [B]          Toggle Algorithm (Laplace vs Biharmonic)\n" 
+              << "  [M]          Toggle Multigrid V-cycles\n" 
+              << "  [T]          Toggle Fast Marching (one pass)\n" 
+              << "  [C]          Solve exactly with preconditioned conjugate gradients\n" 
+              << "  [P]          Fill with texture from around the hole (PatchMatch)\n" 
               << "  [[/]]        Brush Size\n" 
-              << "  [R]          Reload Image\n" << std::endl;
+              << "  [-/=]        Over-relaxation (SOR omega)\n" 
+              << "  [Z/Y]        Undo / Redo Stroke\n" 
+              << "  [R]          Reload Image\n" 
+              << "  --tol <t>    Stop solving once the relative residual |b - Au| / |b| is below t\n" 
+              << "  --space <s>  Solve in rgb, ycbcr (default) or hsluv\n" 
+              << "  --budget <ms>      Solver time between brush updates and display refreshes (default 14)\n" 
+              << "  --publish-hz <hz>  Display conversions per second while solving (default 60)\n" << std::endl;
 
     while (!quit) {
         while (SDL_PollEvent(&e)) {
@@ -411,38 +3386,46 @@ int main(int argc, char* argv[]) {
             else if (e.type == SDL_EVENT_MOUSE_BUTTON_DOWN) {
                 if (e.button.button == SDL_BUTTON_LEFT) {
                     isLeftMouseDown = true;
-                    applyBrush(image, (int)e.button.x, (int)e.button.y, !isSolving);
-                    textureNeedsUpdate = true;
+                    int x = (int)e.button.x, y = (int)e.button.y, radius = BRUSH_RADIUS;
+                    solver.post([&, x, y, radius] {
+                        solver.beginStroke();
+                        solver.brush(x, y, radius);
+                    });
                 }
             }
             else if (e.type == SDL_EVENT_MOUSE_BUTTON_UP) {
                 if (e.button.button == SDL_BUTTON_LEFT) {
                     isLeftMouseDown = false;
+                    solver.post([&] { solver.endStroke(); });
                 }
             }
             else if (e.type == SDL_EVENT_MOUSE_MOTION) {
                 if (isLeftMouseDown) {
-                    applyBrush(image, (int)e.motion.x, (int)e.motion.y, !isSolving);
-                    textureNeedsUpdate = true;
+                    int x = (int)e.motion.x, y = (int)e.motion.y, radius = BRUSH_RADIUS;
+                    solver.post([&, x, y, radius] { solver.brush(x, y, radius); });
                 }
             }
             else if (e.type == SDL_EVENT_KEY_DOWN) {
                 switch (e.key.key) {
                     case SDLK_SPACE:
-                        isSolving = !isSolving;
+                        solver.post([&] { solver.toggleSolving(); });
                         break;
                     case SDLK_R:
-                        loadImage(imagePath, image);
-                        textureNeedsUpdate = true;
-                        isSolving = false;
-                        std::cout << "Image Reloaded" << std::endl;
+                        solver.post([&] {
+                            loadImage(imagePath, image);
+                            solver.imageReplaced();
+                            solver.solving = false;
+                            std::cout << "Image Reloaded" << std::endl;
+                        });
                         break;
                     case SDLK_S:
-                        saveImage(image, "saved.png");
-                        std::cout << "Image Saved" << std::endl;
+                        solver.post([&] {
+                            saveImage(image, "saved.png");
+                            std::cout << "Image Saved" << std::endl;
+                        });
                         break;
                     case SDLK_Q:
-                        exit(0);
+                        quit = true;
                         break;
                     case SDLK_RIGHTBRACKET:
                         BRUSH_RADIUS = std::min(100, BRUSH_RADIUS + 2);
@@ -452,46 +3435,72 @@ int main(int argc, char* argv[]) {
                         BRUSH_RADIUS = std::max(2, BRUSH_RADIUS - 2);
                         std::cout << "Brush Radius: " << BRUSH_RADIUS << std::endl;
                         break;
+                    case SDLK_EQUALS:
+                    case SDLK_MINUS: {
+                        omega = std::clamp(omega + (e.key.key == SDLK_EQUALS ? 0.05 : -0.05), 1.0, 1.95);
+                        solver.post([value = omega] { SOR_OMEGA = value; });
+                        std::cout << "SOR omega: " << omega << std::endl;
+                        break;
+                    }
                     case SDLK_B:
                         useBiharmonic = !useBiharmonic;
-                        SDL_SetWindowTitle(window, useBiharmonic ? 
-                            "SDL3 Inpainting - Mode: Biharmonic (Curvature)" : 
-                            "SDL3 Inpainting - Mode: Laplace (Gradient)");
+                        solver.post([&, on = useBiharmonic] { solver.biharmonic = on; });
                         std::cout << "Algorithm: " << (useBiharmonic ? "Biharmonic" : "Laplace") << std::endl;
                         break;
                     case SDLK_F:
-                        useFill = !useFill;
-                        std::cout << "Algorithm: " << (useFill ? "Fill" : (useBiharmonic ? "Biharmonic" : "Laplace")) << std::endl;
+                        fill = !fill;
+                        solver.post([on = fill] { useFill = on; });
+                        std::cout << "Algorithm: " << (fill ? "Fill" : (useBiharmonic ? "Biharmonic" : "Laplace")) << std::endl;
+                        break;
+                    case SDLK_T:
+                        march = !march;
+                        solver.post([on = march] { useMarch = on; });
+                        std::cout << "Fast marching: " << (march ? "On" : "Off") << std::endl;
+                        break;
+                    case SDLK_M:
+                        useMultigrid = !useMultigrid;
+                        solver.post([&, on = useMultigrid] { solver.multigridMode = on; });
+                        std::cout << "Multigrid: " << (useMultigrid ? "On" : "Off") << std::endl;
+                        break;
+                    case SDLK_C:
+                        solver.post([&] { solver.solveExact(); });
+                        break;
+                    case SDLK_Z:
+                    case SDLK_Y: {
+                        bool redo = e.key.key == SDLK_Y;
+                        solver.post([&, redo] { solver.revert(redo); });
+                        break;
+                    }
+                    case SDLK_P:
+                        solver.post([&] { solver.fillExemplar(); });
                         break;
                 }
             }
         }
 
-        // Run Solver Logic
-        if (isSolving) {
-            // Biharmonic is heavier, so we might do fewer iterations to keep FPS up
-            // or just do the same amount if the CPU is fast enough.
-            int iterations = useFill ? 1 : (useBiharmonic ? 5 : 40);
-            for (int k = 0; k < iterations; ++k) {
-                if (useFill) {
-                    fillMask(image);
-                } else if (useBiharmonic) {
-                    solveBiharmonicStep(image);
-                } else {
-                    solveLaplaceStep(image);
-                }
+        // Title bar: mode and the solver's rate over the last half second
+        Uint64 now = SDL_GetPerformanceCounter();
+        if (now - lastTitle > SDL_GetPerformanceFrequency() / 2) {
+            long long total = solver.sweeps;
+            double rate = (total - lastSweeps) * (double)SDL_GetPerformanceFrequency() / (now - lastTitle);
+            bool solverMode = !fill && !march;
+            std::string title = std::string("SDL3 Inpainting - Mode: ") +
+                (fill ? "Fill" : march ? "Fast Marching" : useBiharmonic ? "Biharmonic (Curvature)" : "Laplace (Gradient)") +
+                (useMultigrid && solverMode ? ", Multigrid" : "");
+            if (solver.solving) {
+                std::ostringstream stats;
+                stats.precision(2);
+                stats << " - " << (long long)rate << (useMultigrid && solverMode ? " cycles/s, " : " sweeps/s, ")
+                      << solver.batchSweeps << " per " << budgetMs << " ms batch, convert "
+                      << solver.convertSeconds * 1000.0 << " ms";
+                title += stats.str();
             }
-            textureNeedsUpdate = true;
+            SDL_SetWindowTitle(window, title.c_str());
+            lastSweeps = total;
+            lastTitle = now;
         }
 
-        if (textureNeedsUpdate) {
-            void* pixels = nullptr;
-            int pitch = 0;
-            
-            image.toTexture(texture);
-    
-            textureNeedsUpdate = false;
-        }
+        solver.upload(texture);
 
         SDL_RenderClear(renderer);
         SDL_RenderTexture(renderer, texture, NULL, NULL);
@@ -508,9 +3517,87 @@ int main(int argc, char* argv[]) {
         SDL_RenderPresent(renderer);
     }
 
+    solver.stop();
     SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
     return 0;
-}
\ No newline at end of file
+}
+int main(int argc, char* argv[]) {
+    // Batch and tiled runs parse their own options and never touch the video subsystem:
+    //   --batch <manifest>                  solve every image/mask pair of a manifest
+    //   --make-tiles <image> <mask> <store> convert to a tile store (--tile <size>, default 512)
+    //   --tiled <store>                     solve a tile store in place, hole by hole
+    //   --untile <store> <output>           write a tile store back out as an image (.ppm is streamed)
+    //   --bench <output.csv>                run every solver on synthetic masks (--size <n>, default 512; - = stdout)
+    //   --check-hsluv                       compare the HSLuv display table with hsluv.c
+    for (int i = 1; i < argc; ++i) {
+        std::string command = argv[i];
+        if (command != "--batch" && command != "--make-tiles" && command != "--tiled" && command != "--untile" &&
+            command != "--bench" && command != "--check-hsluv")
+            continue;
+        int operands = command == "--make-tiles" ? 3 : command == "--untile" ? 2 : command == "--check-hsluv" ? 0 : 1;
+        if (i + operands >= argc) {
+            std::cerr << command << " needs " << operands << " argument(s)" << std::endl;
+            return 1;
+        }
+        SolveMethod method = METHOD_SOR;
+        bool biharmonic = false;
+        int threads = std::max(1u, std::thread::hardware_concurrency());
+        int tile = 512;
+        int size = 512;
+        for (int j = 1; j < argc; ++j) {
+            std::string arg = argv[j];
+            std::string value = j + 1 < argc ? argv[j + 1] : "";
+            if (arg == "--biharmonic") biharmonic = true;
+            if (arg == "--no-simd") useSIMD = false;
+            if (arg == "--tol" && !value.empty()) SOLVE_TOLERANCE = std::stod(value);
+            if (arg == "--threads" && !value.empty()) threads = std::max(1, std::stoi(value));
+            if (arg == "--tile" && !value.empty()) tile = std::max(16, std::stoi(value));
+            if (arg == "--size" && !value.empty()) size = std::max(64, std::stoi(value));
+            if (arg == "--solver") {
+                if (value == "multigrid") method = METHOD_MULTIGRID;
+                else if (value == "cg") method = METHOD_CG;
+                else if (value == "fill") method = METHOD_FILL;
+                else if (value == "march") method = METHOD_MARCH;
+                else if (value == "patch") method = METHOD_PATCH;
+                else if (value != "sor") std::cerr << "Unknown solver '" << value << "', using sor" << std::endl;
+            }
+        }
+        if (!SDL_Init(0)) {
+            std::cerr << "SDL init failed: " << SDL_GetError() << std::endl;
+            return 1;
+        }
+        int result;
+        if (command == "--batch") result = runBatch(argv[i + 1], method, biharmonic, threads);
+        else if (command == "--tiled") result = runTiled(argv[i + 1], method, biharmonic);
+        else if (command == "--bench") result = runBenchmark(argv[i + 1], size);
+        else if (command == "--check-hsluv") result = runHSLuvCheck();
+        else if (command == "--make-tiles") result = makeTiles(argv[i + 1], argv[i + 2], argv[i + 3], tile) ? 0 : 1;
+        else result = untile(argv[i + 1], argv[i + 2]) ? 0 : 1;
+        SDL_Quit();
+        return result;
+    }
+
+    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+        std::cerr << "SDL init failed: " << SDL_GetError() << std::endl;
+        return 1;
+    }
+
+    // The solvers are compiled per colour space, so the space is picked once, here
+    std::string space = "ycbcr";
+    for (int i = 1; i + 1 < argc; ++i)
+        if (std::string(argv[i]) == "--space") space = argv[i + 1];
+    if (space == "rgb") {
+        FloatImage image;
+        return runWindow(image, argc, argv);
+    }
+    if (space == "hsluv") {
+        HSLuvImage image;
+        return runWindow(image, argc, argv);
+    }
+    if (space != "ycbcr") std::cerr << "Unknown colour space '" << space << "', using ycbcr" << std::endl;
+    YcbcrImage image;
+    return runWindow(image, argc, argv);
+}
@@ -1,72 +1,1281 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
-#include <complex>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
 
 #include "SDL.h"
 #include "SDL_events.h"
 
+// Escape-time kernels: out[k] is the number of iterations point (cx[k], cy[k]) survives
+// before |z| > 4, or n if it never escapes. All of them test the squared magnitude.
+// Orbits are also compared against a copy saved at iterations 1, 2, 4, 8, ... (Brent);
+// an orbit that comes back within epsilon of it has settled into a cycle and is
+// counted as inside without running to n. Returns how many points that caught.
+typedef int (*EscapeKernel)(const double* cx, const double* cy, int count, int n, double epsilon, int* out);
+
+int escapeScalar(const double* cx, const double* cy, int count, int n, double epsilon, int* out) {
+    double tolerance = epsilon * epsilon;
+    int periodic = 0;
+    for (int k = 0; k < count; k++) {
+        double zr = 0, zi = 0, sr = 0, si = 0;
+        int j = 0;
+        for (int check = 1; j < n; j++) {
+            double t = zr * zr - zi * zi + cx[k];
+            zi = 2 * zr * zi + cy[k];
+            zr = t;
+            if (zr * zr + zi * zi > 16) {
+                break;
+            }
+            if ((zr - sr) * (zr - sr) + (zi - si) * (zi - si) < tolerance) {
+                j = n;
+                periodic++;
+                break;
+            }
+            if (j == check) {
+                sr = zr;
+                si = zi;
+                check *= 2;
+            }
+        }
+        out[k] = j;
+    }
+    return periodic;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// Vector kernels keep iterating finished lanes but stop counting them; a block ends
+// when every lane has escaped or cycled. A last partial block is padded with copies
+// of its last point, which finish with it; a scalar tail would cost about as much.
+template <int W>
+struct Block {
+    const double* cx;
+    const double* cy;
+    int valid;
+    alignas(32) double px[W], py[W];
+    alignas(32) int32_t counts[W];
+
+    Block(const double* x, const double* y, int left) : cx(x), cy(y), valid(std::min(left, W)) {
+        if (valid < W) {
+            for (int i = 0; i < W; i++) {
+                px[i] = x[std::min(i, valid - 1)];
+                py[i] = y[std::min(i, valid - 1)];
+            }
+            cx = px;
+            cy = py;
+        }
+    }
+
+    // Copies the valid counts out; returns how many of those lanes cycled
+    int finish(int* out, int cycled) {
+        memcpy(out, counts, valid * sizeof(int32_t));
+        return __builtin_popcount(cycled & ((1 << valid) - 1));
+    }
+};
+
+__attribute__((target("avx2")))
+int escapeAVX2(const double* cx, const double* cy, int count, int n, double epsilon, int* out) {
+    const __m256d limit = _mm256_set1_pd(16), one = _mm256_set1_pd(1), cap = _mm256_set1_pd(n);
+    const __m256d tolerance = _mm256_set1_pd(epsilon * epsilon);
+    int periodic = 0;
+    for (int k = 0; k < count; k += 4) {
+        Block<4> block(cx + k, cy + k, count - k);
+        __m256d cr = _mm256_loadu_pd(block.cx), ci = _mm256_loadu_pd(block.cy);
+        __m256d zr = _mm256_setzero_pd(), zi = zr, zr2 = zr, zi2 = zr, sr = zr, si = zr, iters = zr, cycled = zr;
+        __m256d active = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+        for (int j = 0, check = 1; j < n; j++) {
+            zi = _mm256_add_pd(_mm256_mul_pd(_mm256_add_pd(zr, zr), zi), ci);
+            zr = _mm256_add_pd(_mm256_sub_pd(zr2, zi2), cr);
+            zr2 = _mm256_mul_pd(zr, zr);
+            zi2 = _mm256_mul_pd(zi, zi);
+            active = _mm256_and_pd(active, _mm256_cmp_pd(_mm256_add_pd(zr2, zi2), limit, _CMP_LE_OQ));
+            __m256d dr = _mm256_sub_pd(zr, sr), di = _mm256_sub_pd(zi, si);
+            __m256d drift = _mm256_add_pd(_mm256_mul_pd(dr, dr), _mm256_mul_pd(di, di));
+            __m256d close = _mm256_and_pd(active, _mm256_cmp_pd(drift, tolerance, _CMP_LT_OQ));
+            cycled = _mm256_or_pd(cycled, close);
+            active = _mm256_andnot_pd(close, active);
+            if (_mm256_testz_pd(active, active)) break;
+            iters = _mm256_add_pd(iters, _mm256_and_pd(active, one));
+            if (j == check) {
+                sr = zr;
+                si = zi;
+                check *= 2;
+            }
+        }
+        iters = _mm256_blendv_pd(iters, cap, cycled);
+        _mm_store_si128((__m128i*)block.counts, _mm256_cvtpd_epi32(iters));
+        periodic += block.finish(out + k, _mm256_movemask_pd(cycled));
+    }
+    return periodic;
+}
+
+// Single precision doubles the lanes; only used while the pixel spacing is coarse
+__attribute__((target("avx2")))
+int escapeAVX2f(const double* cx, const double* cy, int count, int n, double epsilon, int* out) {
+    const __m256 limit = _mm256_set1_ps(16), one = _mm256_set1_ps(1), cap = _mm256_set1_ps(n);
+    const __m256 tolerance = _mm256_set1_ps((float)(epsilon * epsilon));
+    int periodic = 0;
+    for (int k = 0; k < count; k += 8) {
+        Block<8> block(cx + k, cy + k, count - k);
+        __m256 cr = _mm256_set_m128(_mm256_cvtpd_ps(_mm256_loadu_pd(block.cx + 4)), _mm256_cvtpd_ps(_mm256_loadu_pd(block.cx)));
+        __m256 ci = _mm256_set_m128(_mm256_cvtpd_ps(_mm256_loadu_pd(block.cy + 4)), _mm256_cvtpd_ps(_mm256_loadu_pd(block.cy)));
+        __m256 zr = _mm256_setzero_ps(), zi = zr, zr2 = zr, zi2 = zr, sr = zr, si = zr, iters = zr, cycled = zr;
+        __m256 active = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int j = 0, check = 1; j < n; j++) {
+            zi = _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(zr, zr), zi), ci);
+            zr = _mm256_add_ps(_mm256_sub_ps(zr2, zi2), cr);
+            zr2 = _mm256_mul_ps(zr, zr);
+            zi2 = _mm256_mul_ps(zi, zi);
+            active = _mm256_and_ps(active, _mm256_cmp_ps(_mm256_add_ps(zr2, zi2), limit, _CMP_LE_OQ));
+            __m256 dr = _mm256_sub_ps(zr, sr), di = _mm256_sub_ps(zi, si);
+            __m256 drift = _mm256_add_ps(_mm256_mul_ps(dr, dr), _mm256_mul_ps(di, di));
+            __m256 close = _mm256_and_ps(active, _mm256_cmp_ps(drift, tolerance, _CMP_LT_OQ));
+            cycled = _mm256_or_ps(cycled, close);
+            active = _mm256_andnot_ps(close, active);
+            if (_mm256_testz_ps(active, active)) break;
+            iters = _mm256_add_ps(iters, _mm256_and_ps(active, one));
+            if (j == check) {
+                sr = zr;
+                si = zi;
+                check *= 2;
+            }
+        }
+        iters = _mm256_blendv_ps(iters, cap, cycled);
+        _mm256_store_si256((__m256i*)block.counts, _mm256_cvtps_epi32(iters));
+        periodic += block.finish(out + k, _mm256_movemask_ps(cycled));
+    }
+    return periodic;
+}
+
+__attribute__((target("sse2")))
+int escapeSSE2(const double* cx, const double* cy, int count, int n, double epsilon, int* out) {
+    const __m128d limit = _mm_set1_pd(16), one = _mm_set1_pd(1), cap = _mm_set1_pd(n);
+    const __m128d tolerance = _mm_set1_pd(epsilon * epsilon);
+    int periodic = 0;
+    for (int k = 0; k < count; k += 2) {
+        Block<2> block(cx + k, cy + k, count - k);
+        __m128d cr = _mm_loadu_pd(block.cx), ci = _mm_loadu_pd(block.cy);
+        __m128d zr = _mm_setzero_pd(), zi = zr, zr2 = zr, zi2 = zr, sr = zr, si = zr, iters = zr, cycled = zr;
+        __m128d active = _mm_castsi128_pd(_mm_set1_epi32(-1));
+        for (int j = 0, check = 1; j < n; j++) {
+            zi = _mm_add_pd(_mm_mul_pd(_mm_add_pd(zr, zr), zi), ci);
+            zr = _mm_add_pd(_mm_sub_pd(zr2, zi2), cr);
+            zr2 = _mm_mul_pd(zr, zr);
+            zi2 = _mm_mul_pd(zi, zi);
+            active = _mm_and_pd(active, _mm_cmple_pd(_mm_add_pd(zr2, zi2), limit));
+            __m128d dr = _mm_sub_pd(zr, sr), di = _mm_sub_pd(zi, si);
+            __m128d drift = _mm_add_pd(_mm_mul_pd(dr, dr), _mm_mul_pd(di, di));
+            __m128d close = _mm_and_pd(active, _mm_cmplt_pd(drift, tolerance));
+            cycled = _mm_or_pd(cycled, close);
+            active = _mm_andnot_pd(close, active);
+            if (!_mm_movemask_pd(active)) break;
+            iters = _mm_add_pd(iters, _mm_and_pd(active, one));
+            if (j == check) {
+                sr = zr;
+                si = zi;
+                check *= 2;
+            }
+        }
+        iters = _mm_or_pd(_mm_and_pd(cycled, cap), _mm_andnot_pd(cycled, iters));
+        _mm_storel_epi64((__m128i*)block.counts, _mm_cvtpd_epi32(iters));
+        periodic += block.finish(out + k, _mm_movemask_pd(cycled));
+    }
+    return periodic;
+}
+
+__attribute__((target("sse2")))
+int escapeSSE2f(const double* cx, const double* cy, int count, int n, double epsilon, int* out) {
+    const __m128 limit = _mm_set1_ps(16), one = _mm_set1_ps(1), cap = _mm_set1_ps(n);
+    const __m128 tolerance = _mm_set1_ps((float)(epsilon * epsilon));
+    int periodic = 0;
+    for (int k = 0; k < count; k += 4) {
+        Block<4> block(cx + k, cy + k, count - k);
+        __m128 cr = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(block.cx)), _mm_cvtpd_ps(_mm_loadu_pd(block.cx + 2)));
+        __m128 ci = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(block.cy)), _mm_cvtpd_ps(_mm_loadu_pd(block.cy + 2)));
+        __m128 zr = _mm_setzero_ps(), zi = zr, zr2 = zr, zi2 = zr, sr = zr, si = zr, iters = zr, cycled = zr;
+        __m128 active = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int j = 0, check = 1; j < n; j++) {
+            zi = _mm_add_ps(_mm_mul_ps(_mm_add_ps(zr, zr), zi), ci);
+            zr = _mm_add_ps(_mm_sub_ps(zr2, zi2), cr);
+            zr2 = _mm_mul_ps(zr, zr);
+            zi2 = _mm_mul_ps(zi, zi);
+            active = _mm_and_ps(active, _mm_cmple_ps(_mm_add_ps(zr2, zi2), limit));
+            __m128 dr = _mm_sub_ps(zr, sr), di = _mm_sub_ps(zi, si);
+            __m128 drift = _mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(di, di));
+            __m128 close = _mm_and_ps(active, _mm_cmplt_ps(drift, tolerance));
+            cycled = _mm_or_ps(cycled, close);
+            active = _mm_andnot_ps(close, active);
+            if (!_mm_movemask_ps(active)) break;
+            iters = _mm_add_ps(iters, _mm_and_ps(active, one));
+            if (j == check) {
+                sr = zr;
+                si = zi;
+                check *= 2;
+            }
+        }
+        iters = _mm_or_ps(_mm_and_ps(cycled, cap), _mm_andnot_ps(cycled, iters));
+        _mm_store_si128((__m128i*)block.counts, _mm_cvtps_epi32(iters));
+        periodic += block.finish(out + k, _mm_movemask_ps(cycled));
+    }
+    return periodic;
+}
+
+void chooseKernels(EscapeKernel* precise, EscapeKernel* fast, const char** name) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        *precise = escapeAVX2;
+        *fast = escapeAVX2f;
+        *name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        *precise = escapeSSE2;
+        *fast = escapeSSE2f;
+        *name = "sse2";
+    } else {
+        *precise = *fast = escapeScalar;
+        *name = "scalar";
+    }
+}
+#else
+void chooseKernels(EscapeKernel* precise, EscapeKernel* fast, const char** name) {
+    *precise = *fast = escapeScalar;
+    *name = "scalar";
+}
+#endif
+
+// Widest pixel spacing at which float still resolves neighbouring points well
+// below the detail the 64 iteration palette can show
+const double FLOAT_SPACING = 1e-4;
+
+// Below this spacing double pixel coordinates run out of bits; views render as
+// perturbations from a reference orbit instead
+const double DEEP_SPACING = 1e-12;
+
+// Where the double-double centre itself runs out of bits; further zooms are ignored
+const double MIN_SPACING = 1e-29;
+
+// Zooming out stops once the whole set fits in the window
+const int MIN_DEPTH = -1;
+
+// Double-double: an unevaluated sum hi + lo carrying about 106 bits. The error-free
+// transforms below rely on every operation rounding to double, so x87 builds
+// must use SSE maths.
+#if defined(__i386__) && !defined(__SSE2_MATH__)
+#error "double-double arithmetic needs -msse2 -mfpmath=sse"
+#endif
+
+struct DD {
+    double hi, lo;
+    DD(double v = 0) : hi(v), lo(0) {}
+    DD(double h, double l) : hi(h), lo(l) {}
+};
+
+DD quickTwoSum(double a, double b) {
+    double s = a + b;
+    return DD(s, b - (s - a));
+}
+
+DD twoSum(double a, double b) {
+    double s = a + b;
+    double v = s - a;
+    return DD(s, (a - (s - v)) + (b - v));
+}
+
+// Dekker's product, exact without relying on a fused multiply-add
+DD twoProd(double a, double b) {
+    const double SPLIT = 134217729.0;  // 2^27 + 1
+    double p = a * b;
+    double ta = SPLIT * a, ah = ta - (ta - a), al = a - ah;
+    double tb = SPLIT * b, bh = tb - (tb - b), bl = b - bh;
+    return DD(p, ((ah * bh - p) + ah * bl + al * bh) + al * bl);
+}
+
+DD operator+(DD a, DD b) {
+    DD s = twoSum(a.hi, b.hi);
+    DD t = twoSum(a.lo, b.lo);
+    s = quickTwoSum(s.hi, s.lo + t.hi);
+    return quickTwoSum(s.hi, s.lo + t.lo);
+}
+
+DD operator-(DD a) {
+    return DD(-a.hi, -a.lo);
+}
+
+DD operator-(DD a, DD b) {
+    return a + -b;
+}
+
+DD operator*(DD a, DD b) {
+    DD p = twoProd(a.hi, b.hi);
+    return quickTwoSum(p.hi, p.lo + (a.hi * b.lo + a.lo * b.hi));
+}
+
+// Largest whole number not above a. Double-doubles hold whole numbers exactly up to
+// 2^106, enough for pixel positions on the grids of the deepest levels.
+DD floorDD(DD a) {
+    double hi = floor(a.hi);
+    if (hi != a.hi) {
+        return DD(hi);  // lo is under half an ulp of hi, so it cannot reach a whole number
+    }
+    return quickTwoSum(hi, floor(a.lo));
+}
+
+// Escape count computed entirely in double-double; the fallback for points no
+// reference orbit could resolve
+int escapeDD(DD cx, DD cy, int n) {
+    DD zr = 0, zi = 0;
+    int j = 0;
+    for (j = 0; j < n; j++) {
+        DD t = zr * zr - zi * zi + cx;
+        zi = DD(2) * zr * zi + cy;
+        zr = t;
+        if (zr.hi * zr.hi + zi.hi * zi.hi > 16) {
+            break;
+        }
+    }
+    return j;
+}
+
+// Perturbation reference: the orbit Z_0 .. Z_length of the point (ox, oy) away from
+// the view centre, iterated in double-double and stored rounded to double, where
+// Z_length is the escaped value if the point escapes before n. Every other point
+// c = reference + dc follows
+//     d_k+1 = 2 Z_k d_k + d_k^2 + dc,    z_k = Z_k + d_k
+// entirely in double. The first `skip` iterations are replaced by the cubic series
+// d_skip = A dc + B dc^2 + C dc^3, truncated while the cubic term stays negligible
+// across the view.
+struct Reference {
+    double ox, oy;
+    std::vector<double> zr, zi;
+    int length;
+    int skip;
+    double ar, ai, br, bi, cr, ci;
+};
+
+const double SERIES_TOLERANCE = 1e-12;  // bound on |C| r^3 relative to |A| r
+const double GLITCH = 1e-6;             // |z|^2 below this fraction of |Z|^2 is a glitch
+const int REREFERENCES = 4;             // new references tried per row before falling back
+const int PROBES = 8;                   // probe grid for the view's reference, per side
+
+// radius bounds |dc| over the points that will use the reference; 0 skips the series
+std::shared_ptr<const Reference> makeReference(DD x0, DD y0, double ox, double oy, int n, double radius) {
+    std::shared_ptr<Reference> ref = std::make_shared<Reference>();
+    ref->ox = ox;
+    ref->oy = oy;
+    ref->zr.push_back(0);
+    ref->zi.push_back(0);
+    DD cx = x0 + ox, cy = y0 + oy;
+    DD zr = 0, zi = 0;
+    int k = 0;
+    while (k < n) {
+        DD t = zr * zr - zi * zi + cx;
+        zi = DD(2) * zr * zi + cy;
+        zr = t;
+        k++;
+        ref->zr.push_back(zr.hi);
+        ref->zi.push_back(zi.hi);
+        if (zr.hi * zr.hi + zi.hi * zi.hi > 16) {
+            break;
+        }
+    }
+    ref->length = k;
+
+    // Series coefficients start at 0 (d_0 = 0) and follow
+    //     A' = 2 Z A + 1,  B' = 2 Z B + A^2,  C' = 2 Z C + 2 A B
+    double ar = 0, ai = 0, br = 0, bi = 0, cr = 0, ci = 0;
+    ref->skip = 0;
+    ref->ar = ref->ai = ref->br = ref->bi = ref->cr = ref->ci = 0;
+    double r2 = radius * radius;
+    for (k = 0; radius > 0 && k + 1 < ref->length; k++) {
+        double Zr = ref->zr[k], Zi = ref->zi[k];
+        double nar = 2 * (Zr * ar - Zi * ai) + 1;
+        double nai = 2 * (Zr * ai + Zi * ar);
+        double nbr = 2 * (Zr * br - Zi * bi) + (ar * ar - ai * ai);
+        double nbi = 2 * (Zr * bi + Zi * br) + 2 * ar * ai;
+        double ncr = 2 * (Zr * cr - Zi * ci) + 2 * (ar * br - ai * bi);
+        double nci = 2 * (Zr * ci + Zi * cr) + 2 * (ar * bi + ai * br);
+        double a = sqrt(nar * nar + nai * nai), c = sqrt(ncr * ncr + nci * nci);
+        if (!(c * r2 <= SERIES_TOLERANCE * a)) {
+            break;
+        }
+        ar = nar, ai = nai, br = nbr, bi = nbi, cr = ncr, ci = nci;
+        ref->skip = k + 1;
+        ref->ar = ar, ref->ai = ai, ref->br = br, ref->bi = bi, ref->cr = cr, ref->ci = ci;
+    }
+    return ref;
+}
+
+// The view's main reference. A reference that escapes early makes every point that
+// outlives it a glitch, so if the centre escapes the longest lived point of a probe
+// grid is used instead.
+std::shared_ptr<const Reference> viewReference(DD x0, DD y0, double scale, int n) {
+    double ox = 0, oy = 0;
+    int best = escapeDD(x0, y0, n);
+    for (int i = 0; i < PROBES * PROBES && best < n; i++) {
+        double px = ((i % PROBES + 0.5) * 2 / PROBES - 1) * scale;
+        double py = ((i / PROBES + 0.5) * 2 / PROBES - 1) * scale;
+        int count = escapeDD(x0 + px, y0 + py, n);
+        if (count > best) {
+            best = count;
+            ox = px;
+            oy = py;
+        }
+    }
+    return makeReference(x0, y0, ox, oy, n, hypot(scale + fabs(ox), scale + fabs(oy)));
+}
+
+// Escape count of the point (dcr, dci) away from the view centre. Sets glitch when
+// the perturbed orbit can no longer be trusted: it came much closer to 0 than the
+// reference did, or it outlived the reference.
+int perturb(const Reference& ref, double dcr, double dci, int n, bool* glitch) {
+    dcr -= ref.ox;
+    dci -= ref.oy;
+    int j = ref.skip;
+    double dr = 0, di = 0;
+    if (j > 0) {
+        double sr = dcr * dcr - dci * dci, si = 2 * dcr * dci;     // dc^2
+        double tr = sr * dcr - si * dci, ti = sr * dci + si * dcr;  // dc^3
+        dr = (ref.ar * dcr - ref.ai * dci) + (ref.br * sr - ref.bi * si) + (ref.cr * tr - ref.ci * ti);
+        di = (ref.ar * dci + ref.ai * dcr) + (ref.br * si + ref.bi * sr) + (ref.cr * ti + ref.ci * tr);
+        double zr = ref.zr[j] + dr, zi = ref.zi[j] + di;
+        if (zr * zr + zi * zi > 16) {
+            *glitch = true;
+            return j;
+        }
+    }
+    for (; j < n; j++) {
+        if (j >= ref.length) {
+            *glitch = true;
+            return j;
+        }
+        double Zr = ref.zr[j], Zi = ref.zi[j];
+        double t = 2 * (Zr * dr - Zi * di) + (dr * dr - di * di) + dcr;
+        di = 2 * (Zr * di + Zi * dr) + 2 * dr * di + dci;
+        dr = t;
+        Zr = ref.zr[j + 1];
+        Zi = ref.zi[j + 1];
+        double zr = Zr + dr, zi = Zi + di;
+        double mag = zr * zr + zi * zi;
+        if (mag > 16) {
+            return j;
+        }
+        if (mag < GLITCH * (Zr * Zr + Zi * Zi)) {
+            *glitch = true;
+            return j;
+        }
+    }
+    return n;
+}
+
+const int SIZE = 800;
+const int TILE = 32;          // tile edge, a multiple of COARSEST
+const int COARSEST = 8;       // block size of the first progressive pass
+const int PASSES = 4;         // 8x8, 4x4, 2x2, 1x1
+const int PARENT_PASS = 2;    // the 2x2 pass, whose lattice a parent tile's samples make up
+const int SPAN = SIZE / TILE + 1;  // tiles a side of the grid covering the window
+
+// Views live on per level pixel grids. Level d has spacing 2^-d / (SIZE / 2) with
+// pixel (0, 0) at the top left of the first view, so every pixel of level d is
+// pixel (2x, 2y) of level d+1.
+struct View {
+    DD x0, y0;       // centre
+    double scale;    // half the view's width, 2^-depth
+    int n;
+    EscapeKernel kernel;                         // shallow views
+    std::shared_ptr<const Reference> reference;  // deep views
+    int depth;
+    DD left, top;    // the window's top left pixel on its level's grid
+};
+
+// Deeper boundaries take longer to escape
+int iterationLimit(int depth) {
+    return 64 * (1 + std::max(depth, 0) / 8);
+}
+
+// Escape counts of pixels that have not been computed
+const int UNKNOWN = -1;
+const int QUEUED = -2;        // waiting in a batch
+const int GUESS = -3;         // filled as inside by a coarse pass, still to be confirmed
+
+// Where the work of a view went. Pixels of rendered tiles that were neither
+// evaluated nor inherited were filled by boundary tracing; bulbs and periodic are
+// evaluated points that never ran to n.
+struct Skips {
+    long pixels = 0;     // of tiles rendered
+    long evaluated = 0;
+    long bulbs = 0;      // inside the main cardioid or the period-2 bulb
+    long periodic = 0;   // orbit caught in a cycle before n
+    long cached = 0;     // pixels of tiles the cache held
+    long inherited = 0;  // samples taken from cached parent tiles
+};
+
+// Periodicity tolerance as a fraction of the pixel spacing. A point just outside the
+// set can shadow a cycle for a long time, about as closely as it is to the set, so
+// the tolerance has to shrink with the pixels.
+const double PERIOD_TOLERANCE = 1e-3;
+
+// Rectangles with at most this many interior lattice points are evaluated outright
+const int SMALL_RECT = 49;
+
+// The main cardioid and the period-2 bulb hold most of the set's area at shallow zoom
+bool inBulb(double x, double y) {
+    double q = (x - 0.25) * (x - 0.25) + y * y;
+    return q * (q + (x - 0.25)) <= 0.25 * y * y || (x + 1) * (x + 1) + y * y <= 1. / 16;
+}
+
+// Deep points: every point is a perturbation of the view's reference. Points it
+// glitches on get a new reference at one of them, up to REREFERENCES times, and
+// whatever is left is iterated in double-double. dcx/dcy are offsets from the centre.
+void perturbPoints(const View& view, const double* dcx, const double* dcy, int count, int* counts) {
+    int glitched[TILE * TILE];
+    int left = 0;
+    for (int k = 0; k < count; k++) {
+        bool glitch = false;
+        counts[k] = perturb(*view.reference, dcx[k], dcy[k], view.n, &glitch);
+        if (glitch) {
+            glitched[left++] = k;
+        }
+    }
+    for (int attempt = 0; left > 0 && attempt < REREFERENCES; attempt++) {
+        int origin = glitched[0];
+        std::shared_ptr<const Reference> local = makeReference(view.x0, view.y0, dcx[origin], dcy[origin], view.n, 0);
+        int still = 0;
+        for (int i = 0; i < left; i++) {
+            int k = glitched[i];
+            bool glitch = false;
+            counts[k] = perturb(*local, dcx[k], dcy[k], view.n, &glitch);
+            if (glitch) {
+                glitched[still++] = k;
+            }
+        }
+        left = still;
+    }
+    for (int i = 0; i < left; i++) {
+        int k = glitched[i];
+        counts[k] = escapeDD(view.x0 + dcx[k], view.y0 + dcy[k], view.n);
+    }
+}
+
+// Escape counts for a batch of at most a tile of pixels
+void evaluate(const View& view, const int* xs, const int* ys, int count, int* out, Skips& skips) {
+    double cx[TILE * TILE], cy[TILE * TILE];
+    if (view.reference) {
+        for (int k = 0; k < count; k++) {
+            cx[k] = (xs[k] / (SIZE / 2.) - 1) * view.scale;
+            cy[k] = (ys[k] / (SIZE / 2.) - 1) * view.scale;
+        }
+        perturbPoints(view, cx, cy, count, out);
+        return;
+    }
+    int index[TILE * TILE], counts[TILE * TILE];
+    int left = 0;
+    for (int k = 0; k < count; k++) {
+        double x = ((xs[k] / (SIZE / 2.) - 1) * view.scale) + view.x0.hi;
+        double y = ((ys[k] / (SIZE / 2.) - 1) * view.scale) + view.y0.hi;
+        if (inBulb(x, y)) {
+            out[k] = view.n;
+            skips.bulbs++;
+            continue;
+        }
+        cx[left] = x;
+        cy[left] = y;
+        index[left++] = k;
+    }
+    if (left == 0) {
+        return;
+    }
+    double epsilon = view.scale / (SIZE / 2) * PERIOD_TOLERANCE;
+    skips.periodic += view.kernel(cx, cy, left, view.n, epsilon, counts);
+    for (int i = 0; i < left; i++) {
+        out[index[i]] = counts[i];
+    }
+}
+
+Uint32 colour(int count, int n) {
+    int j = count * 255 / n;
+    int r = (j % 64) * 4;
+    int g = j;
+    int b = (j % 32) * 8;
+    return 0xff000000u | (r % 255) << 16 | (g % 255) << 8 | (b % 255);
+}
+
+// Colours a tile whose lattice b is resolved. Pixels between samples take the
+// colour of the lattice point their block starts at; guesses show as inside.
+void paint(const int* counts, int b, const Uint32* colours, int n, Uint32* tile) {
+    for (int y = 0; y < TILE; y++) {
+        for (int x = 0; x < TILE; x++) {
+            int count = counts[y * TILE + x];
+            if (count == UNKNOWN) {
+                count = counts[(y - y % b) * TILE + x - x % b];
+            }
+            tile[y * TILE + x] = colours[count == GUESS ? n : count];
+        }
+    }
+}
+
+// Resolves every point of one pass lattice (spacing b) in a tile by Mariani-Silver
+// subdivision. {c : count(c) = n} has no holes, so a rectangle whose border points all
+// reach n lies in it and its inside is filled without iterating. A rectangle with
+// some border points at n splits in two until it is small; one with none, or a small
+// one, is evaluated outright in a single batch. Only the 1x1 pass fills for good:
+// borders sampled b pixels apart can step over thin filaments, so coarse passes fill
+// with GUESS and the next pass traces those points again. counts holds the tile's
+// pixels; points earlier passes computed are not evaluated again. Gives up as soon
+// as the view goes stale.
+class Tracer {
+public:
+    Tracer(const View& view, int x0, int y0, int x1, int y1, int b, int* counts, Skips& skips,
+           const std::atomic<int>& generation, int expected)
+        : view(view), x0(x0), y0(y0), b(b), w((x1 - x0 + b - 1) / b), h((y1 - y0 + b - 1) / b),
+          counts(counts), skips(skips), generation(generation), expected(expected) {}
+
+    // False if the view went stale before the lattice was resolved
+    bool run() {
+        trace(0, 0, w - 1, h - 1);
+        if (generation != expected) {
+            return false;
+        }
+        skips.evaluated += evaluated;
+        if (b == 1) {
+            skips.pixels += w * h;
+        }
+        return true;
+    }
+
+private:
+    const View& view;
+    int x0, y0, b, w, h;
+    int* counts;
+    Skips& skips;
+    const std::atomic<int>& generation;
+    int expected;
+    int xs[TILE * TILE], ys[TILE * TILE], results[TILE * TILE];
+    int pending = 0;
+    long evaluated = 0;
+
+    int& at(int i, int j) {
+        return counts[j * b * TILE + i * b];
+    }
+
+    void queue(int i, int j) {
+        if (at(i, j) == UNKNOWN || at(i, j) == GUESS) {
+            xs[pending] = x0 + i * b;
+            ys[pending] = y0 + j * b;
+            at(i, j) = QUEUED;  // shared corners go in once
+            pending++;
+        }
+    }
+
+    void flush() {
+        evaluate(view, xs, ys, pending, results, skips);
+        for (int k = 0; k < pending; k++) {
+            counts[(ys[k] - y0) * TILE + xs[k] - x0] = results[k];
+        }
+        evaluated += pending;
+        pending = 0;
+    }
+
+    void trace(int i0, int j0, int i1, int j1) {
+        if (generation != expected) {
+            return;
+        }
+        for (int i = i0; i <= i1; i++) {
+            queue(i, j0);
+            queue(i, j1);
+        }
+        for (int j = j0 + 1; j < j1; j++) {
+            queue(i0, j);
+            queue(i1, j);
+        }
+        flush();
+        if (i1 - i0 < 2 || j1 - j0 < 2) {
+            return;
+        }
+        int border = 2 * (i1 - i0 + j1 - j0), inside = 0;
+        for (int i = i0; i <= i1; i++) {
+            inside += (at(i, j0) == view.n) + (at(i, j1) == view.n);
+        }
+        for (int j = j0 + 1; j < j1; j++) {
+            inside += (at(i0, j) == view.n) + (at(i1, j) == view.n);
+        }
+        if (inside == border) {
+            for (int y = j0 * b + 1; y < j1 * b; y++) {
+                for (int x = i0 * b + 1; x < i1 * b; x++) {
+                    int& count = counts[y * TILE + x];
+                    if (count == UNKNOWN || count == GUESS) {
+                        count = b == 1 ? view.n : GUESS;
+                    }
+                }
+            }
+            return;
+        }
+        // Splitting only pays off while it may still find rectangles to fill
+        if (inside == 0 || (i1 - i0 - 1) * (j1 - j0 - 1) <= SMALL_RECT) {
+            for (int j = j0 + 1; j < j1; j++) {
+                for (int i = i0 + 1; i < i1; i++) {
+                    queue(i, j);
+                }
+            }
+            flush();
+            return;
+        }
+        if (i1 - i0 >= j1 - j0) {
+            int mid = (i0 + i1) / 2;
+            trace(i0, j0, mid, j1);
+            trace(mid, j0, i1, j1);
+        } else {
+            int mid = (j0 + j1) / 2;
+            trace(i0, j0, i1, mid);
+            trace(i0, mid, i1, j1);
+        }
+    }
+};
+
+// The tiles covering a view. Tiles are whole tiles of the view's level grid, so they
+// overhang the window: tile (i, j) is grid tile (x + i, y + j), with its top left
+// pixel at window pixel (ox + i * TILE, oy + j * TILE).
+struct Grid {
+    DD x, y;
+    int ox, oy;
+    int across, down;
+};
+
+Grid gridOf(const View& view) {
+    Grid grid;
+    grid.x = floorDD(view.left * (1. / TILE));
+    grid.y = floorDD(view.top * (1. / TILE));
+    grid.ox = (int)(grid.x * TILE - view.left).hi;
+    grid.oy = (int)(grid.y * TILE - view.top).hi;
+    grid.across = (SIZE - grid.ox + TILE - 1) / TILE;
+    grid.down = (SIZE - grid.oy + TILE - 1) / TILE;
+    return grid;
+}
+
+// Escape counts of finished tiles by level and grid position, least recently used
+// out first once they outgrow CACHE_BYTES. The levels form a quadtree: tile (x, y)
+// of level d covers tiles (2x, 2y) .. (2x + 1, 2y + 1) of level d + 1. A level fixes
+// the iteration limit and the arithmetic, so a tile serves every view of its level.
+const size_t CACHE_BYTES = 64 << 20;
+
+class TileCache {
+public:
+    struct Key {
+        int depth;
+        DD x, y;
+
+        bool operator<(const Key& other) const {
+            return std::tie(depth, x.hi, x.lo, y.hi, y.lo) <
+                   std::tie(other.depth, other.x.hi, other.x.lo, other.y.hi, other.y.lo);
+        }
+    };
+
+    // The tile's counts, valid until the next store, or nullptr if it is not cached
+    const int* find(const Key& key) {
+        auto found = tiles.find(key);
+        if (found == tiles.end()) {
+            return nullptr;
+        }
+        order.splice(order.begin(), order, found->second.use);
+        return found->second.counts.data();
+    }
+
+    void store(const Key& key, const int* counts) {
+        if (find(key)) {
+            return;
+        }
+        if (tiles.size() >= CACHE_BYTES / (TILE * TILE * sizeof(int))) {
+            tiles.erase(order.back());
+            order.pop_back();
+        }
+        order.push_front(key);
+        tiles[key] = Tile{std::vector<int>(counts, counts + TILE * TILE), order.begin()};
+    }
+
+private:
+    struct Tile {
+        std::vector<int> counts;
+        std::list<Key>::iterator use;
+    };
+
+    std::map<Key, Tile> tiles;
+    std::list<Key> order;  // most recently used first
+};
+
+// Renders views on a work-stealing pool. Each worker pops tiles from the back of its
+// own deque and steals from the front of the others' when it runs dry; escape cost
+// varies too much between tiles for a fixed split. A view renders pass by pass and
+// whoever finishes the last tile of a pass queues the next. Finished tiles are
+// copied into the published frame, along with their escape counts for the next
+// pass; tasks from an older view stop at the next batch and are never published.
+// Tiles the cache holds are not rendered at all, and tiles whose parent it holds
+// start from the parent's samples at PARENT_PASS.
+class TileRenderer {
+public:
+    TileRenderer(int threads)
+        : queues(threads), frame(SIZE * SIZE), iterations(SPAN * SPAN * TILE * TILE), first(SPAN * SPAN) {
+        for (int i = 0; i < threads; i++) {
+            workers.emplace_back(&TileRenderer::work, this, i);
+        }
+    }
+
+    ~TileRenderer() {
+        {
+            std::lock_guard<std::mutex> hold(lock);
+            stop = true;
+            cancel();
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    int threads() const {
+        return (int)workers.size();
+    }
+
+    // Drops the current view, including tiles in flight, and starts rendering view.
+    // Whatever the cache has for it is in the frame before this returns.
+    void start(const View& view) {
+        std::lock_guard<std::mutex> hold(lock);
+        cancel();
+        current = view;
+        std::shared_ptr<std::vector<Uint32>> colours = std::make_shared<std::vector<Uint32>>(view.n + 1);
+        for (int count = 0; count <= view.n; count++) {
+            (*colours)[count] = colour(count, view.n);
+        }
+        palette = colours;
+        grid = gridOf(view);
+        started = SDL_GetPerformanceCounter();
+        skipped = Skips();
+        reported = false;
+        Uint32 tile[TILE * TILE];
+        for (int j = 0; j < grid.down; j++) {
+            for (int i = 0; i < grid.across; i++) {
+                int t = j * SPAN + i;
+                int* counts = iterations.data() + t * TILE * TILE;
+                if (const int* cached = cache.find(key(i, j))) {
+                    memcpy(counts, cached, TILE * TILE * sizeof(int));
+                    first[t] = PASSES;
+                    skipped.cached += TILE * TILE;
+                } else if (inherit(key(i, j), counts)) {
+                    first[t] = PARENT_PASS;
+                } else {
+                    std::fill(counts, counts + TILE * TILE, UNKNOWN);
+                    first[t] = 0;
+                    continue;
+                }
+                paint(counts, first[t] == PASSES ? 1 : COARSEST >> first[t], palette->data(), view.n, tile);
+                publish(grid.ox + i * TILE, grid.oy + j * TILE, tile);
+            }
+        }
+        schedule(0);
+    }
+
+    // Uploads the part of the frame published since the last call; false if none
+    bool upload(SDL_Texture* tex) {
+        std::lock_guard<std::mutex> hold(lock);
+        if (dirty.w <= 0) {
+            return false;
+        }
+        SDL_UpdateTexture(tex, &dirty, frame.data() + dirty.y * SIZE + dirty.x, SIZE * sizeof(Uint32));
+        dirty = SDL_Rect{0, 0, 0, 0};
+        return true;
+    }
+
+    // True once per view, when its last pass is done; seconds is the wall time taken
+    bool finished(double* seconds, Skips* skips) {
+        std::lock_guard<std::mutex> hold(lock);
+        if (remaining || reported) {
+            return false;
+        }
+        reported = true;
+        *seconds = (double)(completed - started) / SDL_GetPerformanceFrequency();
+        *skips = skipped;
+        return true;
+    }
+
+private:
+    struct Task {
+        View view;
+        std::shared_ptr<const std::vector<Uint32>> palette;  // colour per escape count
+        int generation, pass;
+        int x, y;    // window pixel of the tile's top left
+        int tile;    // index into the grid
+        TileCache::Key key;
+    };
+
+    struct Queue {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<Queue> queues;
+    std::vector<std::thread> workers;
+    std::mutex lock;                      // guards everything below, and queueing
+    std::condition_variable wake;
+    std::atomic<int> generation{0};       // bumped to cancel the view being rendered
+    std::atomic<int> queued{0};
+    std::vector<Uint32> frame;
+    std::vector<int> iterations;          // escape counts per grid tile, UNKNOWN between samples
+    std::vector<int> first;               // pass each grid tile starts at, PASSES if cached
+    TileCache cache;
+    SDL_Rect dirty{0, 0, 0, 0};
+    Skips skipped;
+    View current{};
+    Grid grid{};
+    std::shared_ptr<const std::vector<Uint32>> palette;
+    int pass = 0;
+    int remaining = 0;                    // tiles of the current pass still to finish
+    Uint64 started = 0, completed = 0;
+    bool reported = true;
+    bool stop = false;
+
+    void cancel() {
+        generation++;
+        for (Queue& queue : queues) {
+            std::lock_guard<std::mutex> hold(queue.lock);
+            queued -= (int)queue.tasks.size();
+            queue.tasks.clear();
+        }
+        remaining = 0;
+    }
+
+    TileCache::Key key(int i, int j) const {
+        return TileCache::Key{current.depth, grid.x + i, grid.y + j};
+    }
+
+    // Seeds counts with the samples of the tile's parent, every other pixel in both
+    // directions. Escape counts below the parent's limit hold at any limit; points
+    // that reached it are only guesses at this one. False if the parent is not cached.
+    bool inherit(const TileCache::Key& key, int* counts) {
+        DD px = floorDD(key.x * 0.5), py = floorDD(key.y * 0.5);
+        const int* parent = cache.find(TileCache::Key{key.depth - 1, px, py});
+        if (!parent) {
+            return false;
+        }
+        int qx = (int)(key.x - px * 2).hi * (TILE / 2);
+        int qy = (int)(key.y - py * 2).hi * (TILE / 2);
+        int n = iterationLimit(key.depth - 1);
+        std::fill(counts, counts + TILE * TILE, UNKNOWN);
+        for (int y = 0; y < TILE / 2; y++) {
+            for (int x = 0; x < TILE / 2; x++) {
+                int count = parent[(qy + y) * TILE + qx + x];
+                counts[2 * y * TILE + 2 * x] = count < n ? count : GUESS;
+                skipped.inherited += count < n;
+            }
+        }
+        return true;
+    }
+
+    // Copies the part of a tile inside the window into the frame; the caller holds lock
+    void publish(int x, int y, const Uint32* tile) {
+        SDL_Rect area{std::max(x, 0), std::max(y, 0), 0, 0};
+        area.w = std::min(x + TILE, SIZE) - area.x;
+        area.h = std::min(y + TILE, SIZE) - area.y;
+        for (int row = area.y; row < area.y + area.h; row++) {
+            memcpy(frame.data() + row * SIZE + area.x, tile + (row - y) * TILE + area.x - x, area.w * sizeof(Uint32));
+        }
+        if (dirty.w > 0) {
+            int dx1 = std::max(dirty.x + dirty.w, area.x + area.w);
+            int dy1 = std::max(dirty.y + dirty.h, area.y + area.h);
+            area.x = std::min(dirty.x, area.x);
+            area.y = std::min(dirty.y, area.y);
+            area.w = dx1 - area.x;
+            area.h = dy1 - area.y;
+        }
+        dirty = area;
+    }
+
+    // Deals the tiles taking part in the first pass from next that any tile needs
+    // round-robin to the workers; the caller holds lock
+    void schedule(int next) {
+        for (pass = next; pass < PASSES; pass++) {
+            int k = 0;
+            for (int j = 0; j < grid.down; j++) {
+                for (int i = 0; i < grid.across; i++) {
+                    int t = j * SPAN + i;
+                    if (first[t] > pass) {
+                        continue;
+                    }
+                    Queue& queue = queues[k++ % queues.size()];
+                    std::lock_guard<std::mutex> hold(queue.lock);
+                    queue.tasks.push_front(Task{current, palette, generation, pass,
+                                                grid.ox + i * TILE, grid.oy + j * TILE, t, key(i, j)});
+                }
+            }
+            if (k > 0) {
+                remaining = k;
+                queued += k;
+                wake.notify_all();
+                return;
+            }
+        }
+        completed = SDL_GetPerformanceCounter();
+    }
+
+    bool take(int self, Task* task) {
+        int count = (int)queues.size();
+        for (int i = 0; i < count; i++) {
+            Queue& queue = queues[(self + i) % count];
+            std::lock_guard<std::mutex> hold(queue.lock);
+            if (queue.tasks.empty()) {
+                continue;
+            }
+            if (i == 0) {
+                *task = queue.tasks.back();
+                queue.tasks.pop_back();
+            } else {
+                *task = queue.tasks.front();
+                queue.tasks.pop_front();
+            }
+            queued--;
+            return true;
+        }
+        return false;
+    }
+
+    void work(int self) {
+        while (true) {
+            Task task;
+            if (take(self, &task)) {
+                render(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> hold(lock);
+            wake.wait(hold, [this] { return stop || queued > 0; });
+            if (stop) {
+                return;
+            }
+        }
+    }
+
+    void render(const Task& task) {
+        int counts[TILE * TILE];
+        Uint32 tile[TILE * TILE];
+        int b = COARSEST >> task.pass;
+        {
+            // Start from what the coarser passes or the parent tile left
+            std::lock_guard<std::mutex> hold(lock);
+            if (generation != task.generation) {
+                return;
+            }
+            memcpy(counts, iterations.data() + task.tile * TILE * TILE, sizeof(counts));
+        }
+        Skips skips;
+        Tracer tracer(task.view, task.x, task.y, task.x + TILE, task.y + TILE, b, counts, skips, generation,
+                      task.generation);
+        if (!tracer.run()) {
+            return;
+        }
+        paint(counts, b, task.palette->data(), task.view.n, tile);
+
+        std::lock_guard<std::mutex> hold(lock);
+        if (b == 1) {
+            cache.store(task.key, counts);
+        }
+        if (generation != task.generation) {
+            return;
+        }
+        memcpy(iterations.data() + task.tile * TILE * TILE, counts, sizeof(counts));
+        publish(task.x, task.y, tile);
+        skipped.pixels += skips.pixels;
+        skipped.evaluated += skips.evaluated;
+        skipped.bulbs += skips.bulbs;
+        skipped.periodic += skips.periodic;
+        if (--remaining == 0) {
+            schedule(pass + 1);
+        }
+    }
+};
+
+// Sets the iteration limit and arithmetic for the view's depth and centre
+void prepare(View& view, EscapeKernel precise, EscapeKernel fast) {
+    view.n = iterationLimit(view.depth);
+    double spacing = view.scale / (SIZE / 2);
+    view.kernel = spacing > FLOAT_SPACING ? fast : precise;
+    view.reference = nullptr;
+    if (spacing < DEEP_SPACING) {
+        // Tiles overhang the window by up to a tile on every side
+        view.reference = viewReference(view.x0, view.y0, view.scale * (SIZE + 2 * TILE) / SIZE, view.n);
+    }
+}
+
+// Sets the centre and scale from the view's level and grid position. They are derived afresh
+// after every move instead of being stepped along with it, so however a (depth, left, top) is
+// reached, its centre has the same bits and agrees with the cache keys of its tiles.
+void place(View& view) {
+    // 1 / (SIZE / 2) to double-double precision, then exact powers of two
+    double hi = 1.0 / (SIZE / 2);
+    double lo = (DD(1) - twoProd(hi, SIZE / 2)).hi / (SIZE / 2);
+    DD spacing(ldexp(hi, -view.depth), ldexp(lo, -view.depth));
+    view.scale = ldexp(1.0, -view.depth);
+    view.x0 = DD(-1) + (view.left + SIZE / 2) * spacing;
+    view.y0 = DD(-1) + (view.top + SIZE / 2) * spacing;
+}
+
+// The pixel (x, y) of the window becomes the centre of the next level
+void zoomIn(View& view, int x, int y) {
+    view.left = (view.left + x) * 2 - SIZE / 2;
+    view.top = (view.top + y) * 2 - SIZE / 2;
+    view.depth++;
+    place(view);
+}
+
+// Back out about the centre, moved onto the nearest pixel of the coarser level
+void zoomOut(View& view) {
+    view.left = floorDD((view.left + SIZE / 2) * 0.5) - SIZE / 2;
+    view.top = floorDD((view.top + SIZE / 2) * 0.5) - SIZE / 2;
+    view.depth--;
+    place(view);
+}
+
+void pan(View& view, int dx, int dy) {
+    view.left = view.left + dx;
+    view.top = view.top + dy;
+    place(view);
+}
+
+// --check-views: at every level down to the deepest, zooms in on a pixel, back out and pans
+// back by the same pixels, and checks that this lands on the view it started from, centre
+// included, bit for bit. Returns whether every level did.
+bool checkViews() {
+    View view = {0, 0, 1, 0, nullptr, nullptr, 0, 0, 0};
+    place(view);
+    unsigned seed = 1;
+    int failures = 0;
+    while (view.scale / SIZE > MIN_SPACING) {
+        seed = seed * 1664525u + 1013904223u;
+        int x = (seed >> 8) % SIZE, y = (seed >> 20) % SIZE;
+        View start = view;
+        zoomIn(view, x, y);
+        zoomOut(view);
+        pan(view, SIZE / 2 - x, SIZE / 2 - y);
+        const DD* a[4] = {&view.x0, &view.y0, &view.left, &view.top};
+        const DD* b[4] = {&start.x0, &start.y0, &start.left, &start.top};
+        bool same = view.depth == start.depth && view.scale == start.scale;
+        for (int i = 0; i < 4; i++) {
+            same = same && memcmp(a[i], b[i], sizeof(DD)) == 0;
+        }
+        if (!same) {
+            printf("depth %d: zooming in on (%d, %d) and back out moved the centre by (%g, %g)\n", start.depth, x, y,
+                   (view.x0 - start.x0).hi, (view.y0 - start.y0).hi);
+            failures++;
+        }
+        view = start;
+        zoomIn(view, x, y);
+    }
+    printf("%d of %d levels moved\n", failures, view.depth);
+    return failures == 0;
+}
+
 int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--check-views") == 0) {
+        return checkViews() ? 0 : 1;
+    }
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         printf("SDL_Init Error: %s\n", SDL_GetError());
     }
-    SDL_Window *win = SDL_CreateWindow("Hello World!", 100, 100, 1000, 1000, SDL_WINDOW_SHOWN);
+    SDL_Window *win = SDL_CreateWindow("Mandelbrot", 100, 100, SIZE, SIZE, SDL_WINDOW_SHOWN);
     if (win == NULL) {
         printf("SDL_CreateWindow Error: %s\n", SDL_GetError());
         return 1;
     }
     SDL_Renderer *ren = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    SDL_Texture *tex = SDL_CreateTexture(ren, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, SIZE, SIZE);
+    if (ren == NULL || tex == NULL) {
+        printf("SDL_CreateTexture Error: %s\n", SDL_GetError());
+        return 1;
+    }
     SDL_Event e;
     int quit = 0;
-    int i = 0;
-    SDL_SetRenderDrawColor(ren, 0, 0, 0, 255);
-    SDL_RenderClear(ren);
-    srand(time(NULL));
-    int t = clock();
-    double x0 = 0;
-    double y0 = 0;
-    double scale = 1;
-    int n = 64;
+    EscapeKernel precise, fast;
+    const char* kernelName;
+    chooseKernels(&precise, &fast, &kernelName);
+    View view = {0, 0, 1, 64, fast, nullptr, 0, 0, 0};
+    place(view);
+    prepare(view, precise, fast);
+    TileRenderer renderer(std::max(1u, std::thread::hardware_concurrency()));
+    renderer.start(view);
     while (!quit) {
+        bool redraw = false;
         while (SDL_PollEvent(&e)) {
             if (e.type == SDL_QUIT) {
                 quit = 1;
             }
-            if (e.type == SDL_MOUSEBUTTONDOWN) {
-                x0 = (e.button.x / 400. - 1) * scale + x0;
-                y0 = (e.button.y / 400. - 1) * scale + y0;
-                scale /= 2;
-                i = 0;
+            if (e.type == SDL_WINDOWEVENT &&
+                (e.window.event == SDL_WINDOWEVENT_EXPOSED || e.window.event == SDL_WINDOWEVENT_RESTORED ||
+                 e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)) {
+                // Uncovered, restored or resized: the window needs the texture again even when
+                // no tile has changed since it was last presented
+                redraw = true;
+            }
+            if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_LEFT && view.scale / SIZE > MIN_SPACING) {
+                zoomIn(view, e.button.x, e.button.y);
+                prepare(view, precise, fast);
+                renderer.start(view);
+            }
+            if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_RIGHT && view.depth > MIN_DEPTH) {
+                zoomOut(view);
+                prepare(view, precise, fast);
+                renderer.start(view);
+            }
+            if (e.type == SDL_KEYDOWN) {
+                // Arrows pan by a quarter of the window
+                int dx = 0, dy = 0;
+                switch (e.key.keysym.sym) {
+                    case SDLK_LEFT: dx = -SIZE / 4; break;
+                    case SDLK_RIGHT: dx = SIZE / 4; break;
+                    case SDLK_UP: dy = -SIZE / 4; break;
+                    case SDLK_DOWN: dy = SIZE / 4; break;
+                }
+                if (dx || dy) {
+                    pan(view, dx, dy);
+                    prepare(view, precise, fast);
+                    renderer.start(view);
+                }
             }
         }
-        double x = rand() % 800;
-        double y = rand() % 800;
-        if (y < 1000 + i / 800.) {
-            x = i % 800;
-            y = (i / 800) % 800;
-            i++;
-        }
-        double cx = ((x / 400. - 1) * scale) + x0;
-        double cy = ((y / 400. - 1) * scale) + y0;
-        std::complex<double> z = 0;
-        int j = 0;
-        for (j = 0; j < n; j++) {
-            z = z * z + std::complex<double>(cx, cy);
-            if (std::abs(z) > 4) {
-                break;
+        double seconds;
+        Skips skips;
+        if (renderer.finished(&seconds, &skips)) {
+            char method[64];
+            if (view.reference) {
+                snprintf(method, sizeof(method), "perturbation, series skips %d", view.reference->skip);
+            } else {
+                snprintf(method, sizeof(method), "%s %s", kernelName, view.kernel == precise ? "double" : "float");
             }
+            double pixels = std::max(skips.pixels + skips.cached, 1L) / 100.;
+            long traced = skips.pixels - skips.evaluated - skips.inherited;
+            char title[320];
+            snprintf(title, sizeof(title),
+                     "Mandelbrot: zoom 2^%d, %d iterations, %s x %d threads, %.1f Mpoints/s, "
+                     "skipped %.1f%% (cached %.1f%%, inherited %.1f%%, bulbs %.1f%%, periodic %.1f%%, traced %.1f%%)",
+                     view.depth, view.n, method, renderer.threads(), SIZE * SIZE / std::max(seconds, 1e-6) / 1e6,
+                     (skips.cached + skips.inherited + traced + skips.bulbs + skips.periodic) / pixels,
+                     skips.cached / pixels, skips.inherited / pixels, skips.bulbs / pixels,
+                     skips.periodic / pixels, traced / pixels);
+            SDL_SetWindowTitle(win, title);
         }
-        j = j * 255 / n;
-        int r = (j % 64) * 4;
-        int g = j;
-        int b = (j % 32) * 8;
-        SDL_SetRenderDrawColor(ren, r % 255, g % 255, b % 255, 255);
-        SDL_RenderDrawPointF(ren, x, y);
-        if (clock() - t > 10) {
+        if (renderer.upload(tex) || redraw) {
+            SDL_RenderCopy(ren, tex, NULL, NULL);
             SDL_RenderPresent(ren);
-            t = clock();
+        } else {
+            SDL_Delay(5);
         }
     }
+    SDL_DestroyTexture(tex);
     SDL_DestroyRenderer(ren);
     SDL_DestroyWindow(win);
     SDL_Quit();